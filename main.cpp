@@ -18,6 +18,26 @@
 #include "functional"
 #include "algorithm"
 #include "cmath"
+#include "cstdio"
+#include "cstdint"
+#include "cstring"
+#include "cstdlib"
+#include "new"
+#include "atomic"
+
+// Used for splitting work across cores (simulator builds only)
+#ifdef BOGGER_THREADS
+#include "thread"
+#include "mutex"
+#include "condition_variable"
+#endif
+
+// Shared memory for live metrics (POSIX only)
+#if LIVE_METRICS
+#include "sys/mman.h"
+#include "fcntl.h"
+#include "unistd.h"
+#endif
 
 //-------------------------
 // DEFINITIONS / VARIABLES
@@ -30,53 +50,599 @@
 #define LOG_WIDTH1 48
 #define LOG_WIDTH2 96
 #define LOG_WIDTH3 64
+#define LOG_HEIGHT 14
+#define ROWS_ON_SCREEN 12     // Number of rows drawn and updated each frame
+#define ROWS_AHEAD ROWS_ON_SCREEN // Rows kept generated from the frog's row up
+#define MOST_ROWS_GENERATED 6 // Most rows World::Generate adds in one go (up to 5 road or water rows and a grass row)
+#define SNAPSHOT_ROWS 48      // Number of rows kept in a snapshot, counting down from the top of the world
+#define SNAPSHOT_ENTITIES 9   // Most obstacles a row can hold in a snapshot (a row of turtles)
+#define INPUT_QUEUE_SIZE 16   // Moves a hosted session can have waiting
+
+// Batch environment for training agents. Build with -DBATCH_ENVS=<number of games> to benchmark it instead of playing
+#ifndef BATCH_ENVS
+#define BATCH_ENVS 0
+#endif
+#ifndef BATCH_STEPS
+#define BATCH_STEPS 10000 // Steps to run in the benchmark
+#endif
+#define OBS_ROWS ROWS_ON_SCREEN               // Rows in an observation, starting two below the frog like the screen
+#define OBS_COLS (SCREEN_WIDTH / TILE_WIDTH)  // Tiles across a row
+#define OBS_SIZE (OBS_ROWS * OBS_COLS)        // Bytes in one observation
+#define ENV_DT (1.0 / 30)                     // Seconds of game time per step
+#define DEATH_REWARD -1000                    // Added to the reward of a step that kills the frog
+
+// Observing many rows at once. Big grids are split across the worker threads a block of rows at a time
+#define CACHE_LINE 64         // Size of a cache line in bytes
+#define PARALLEL_MIN_ROWS 64  // Fewest rows worth splitting across worker threads
+#define OBS_BLOCK_ROWS 16     // Rows per block, 16 x 20 tiles is exactly 5 cache lines so threads never share one
+
+// Self test. Build with -DSELF_TEST to check snapshots and scoring instead of playing (make test runs it)
+#ifndef SELF_TEST
+#define SELF_TEST 0
+#endif
+#define TEST_STEPS 2000     // Steps of random play the snapshot check runs for
+#define TEST_SAVE_EVERY 50  // Steps between snapshot checks
+#define TEST_ROWS 20        // Rows the scoring check climbs
+#define TEST_WAIT_STEPS 30  // Steps it waits on each row before hopping up
+
+// Stress test for huge worlds. Build with -DSTRESS_ROWS=<number of rows> to time headless ticks instead of playing
+#ifndef STRESS_ROWS
+#define STRESS_ROWS 0
+#endif
+#define STRESS_ENTITIES 200 // Obstacles in every row
+#define STRESS_TICKS 100    // Ticks to time, each one moves the clock and observes every row
+
+// What's in each tile of an observation
+#define CELL_GROUND 0
+#define CELL_CAR 1
+#define CELL_WATER 2
+#define CELL_FLOAT 3 // A log or turtle
+#define CELL_FROG 4
+
+// Telemetry. Every death is recorded and written to TELEMETRY_PATH in blocks, one column of values at a time
+#define TELEMETRY_PATH "Telemetry.dat"
+#define TELEMETRY_BLOCK 1024       // Events held in memory before a block is written
+#define TELEMETRY_MAGIC 0x4C544742 // "BGTL", marks the start of each block
+
+// Live metrics for outside monitors. Build with -DLIVE_METRICS=1 to publish them in POSIX shared memory every frame.
+// Read them with tools/metrics_reader.cpp, which has its own copy of everything below that it depends on
+#ifndef LIVE_METRICS
+#define LIVE_METRICS 0
+#endif
+#define METRICS_NAME "/bogger_metrics" // Shared memory object, followed by a dot and the process ID
+#define METRICS_MAGIC 0x4D544742       // "BGTM", start of the block
+#define METRICS_VERSION 2              // Bump whenever MetricsBlock changes
+#define METRICS_WINDOW 128             // Frames the FPS and frame time percentiles are taken over
+
+// Input latency tracing. Build with -DLATENCY_TRACE=1 to time every move from the touch to the frame that shows it,
+// with a report printed at the end of each game
+#ifndef LATENCY_TRACE
+#define LATENCY_TRACE 0
+#endif
+#define TRACE_INPUT 0     // Touch turned into a move
+#define TRACE_SIMULATED 1 // World stepped with the move
+#define TRACE_DRAWN 2     // Frame with the move drawn
+#define TRACE_PRESENTED 3 // That frame finished
+#define TRACE_STAGES 4
+
+// Memory accounting. Build with -DMEMORY_STATS=1 to count every allocation by what it's for, printed at exit
+#ifndef MEMORY_STATS
+#define MEMORY_STATS 0
+#endif
+#define MEM_OTHER 0
+#define MEM_WORLD 1    // The world's list of rows
+#define MEM_ROWS 2     // Rows and their lists of obstacles
+#define MEM_ENTITIES 3 // Obstacles and the frog
+#define MEM_SCORES 4   // Reading the scores file
+#define MEM_ASSETS 5   // Sprites
+#define MEM_TAGS 6
+#define MEMORY_HEADER 16 // Bytes in front of every tracked allocation, enough to keep it aligned
+
+// Causes of death
+#define DEATH_WATER 0
+#define DEATH_CAR 1
+
+// Frame pacing
+#ifndef TARGET_FPS
+#define TARGET_FPS 60 // Frames per second the game loop is held to
+#endif
+#define SPIN_TIME 0.002    // Seconds before a frame is due where sleeping stops and spinning takes over (sleep isn't that precise)
+#define DEATH_TIME 0.5      // Seconds the frog flashes after dying before the game over screen can be dismissed
+
+// Adaptive quality. When frames take too long the renderer drops to a cheaper level, and goes back up once there's room
+#define QUALITY_FULL 0     // Tiled sprite backgrounds and every pass
+#define QUALITY_FLAT 1     // Flat color backgrounds instead of tiled sprites, and no repeated passes
+#define QUALITY_LOW 2      // Also skips the log underlay and most of the screen clear, and redraws the HUD less often
+#define QUALITY_DOWN 0.9   // Step down when frames use more than this much of the budget
+#define QUALITY_UP 0.5     // Step up when frames use less than this much of the budget
+#define QUALITY_FRAMES 30  // Slow frames in a row before stepping down
+#define QUALITY_UP_FRAMES 120 // Fast frames in a row before stepping up, slower so it doesn't bounce straight back
+#define HUD_REFRESH 6      // At QUALITY_LOW, frames between HUD redraws (the LCD keeps the old one in between)
+
+// Pipelined drawing. Build with -DPIPELINE (and BOGGER_THREADS) to draw each frame on a thread of its own while the next
+// one is simulated
+#if defined(PIPELINE) && !defined(BOGGER_THREADS)
+#error PIPELINE needs BOGGER_THREADS
+#endif
+#define FRAME_FRESH 4 // Flag on the spare frame slot's index when it holds a frame the render thread hasn't seen
+
+// Headless session host settings. Build with -DSESSION_HOST=<number of games> to host games instead of playing one
+#ifndef SESSION_HOST
+#define SESSION_HOST 0
+#endif
+#define HOST_TICK_RATE 50   // Session ticks per second
+#ifndef HOST_TICKS
+#define HOST_TICKS 3000     // Ticks to run before reporting and exiting
+#endif
+
+// Kinds of rows and entities stored in snapshots
+#define KIND_GRASS 0
+#define KIND_ROAD 1
+#define KIND_WATER 2
+#define KIND_CAR 0
+#define KIND_LOG 1
+#define KIND_TURTLE 2
 
 #define SCORES_PATH "Scores.dat" // Scores file
+#define SCORE_SCALE 1000         // The score is kept in thousandths of a point, as a whole number so it adds up the same everywhere
+#define TIME_PENALTY 200         // Points lost per second
+
+// Offscreen frame capture. Build with -DCAPTURE_MODE=1 for a PPM image per frame, or 2 for one raw RGB24 video stream
+// (play it back with: ffplay -f rawvideo -pixel_format rgb24 -video_size 320x240 Capture.rgb, scaled by CAPTURE_SCALE)
+#ifndef CAPTURE_MODE
+#define CAPTURE_MODE 0
+#endif
+#define CAPTURE_PATH "Capture" // Start of the captured file names
+#define CAPTURE_BUFFERS 4      // Frames that can be waiting to be encoded before new ones get skipped
+#ifndef CAPTURE_SCALE
+#define CAPTURE_SCALE 1        // Captured frames are this many times bigger than the screen each way
+#endif
+#define CAPTURE_WIDTH (SCREEN_WIDTH * CAPTURE_SCALE)
+#define CAPTURE_HEIGHT (SCREEN_HEIGHT * CAPTURE_SCALE)
+#define RENDER_BANDS (SCREEN_HEIGHT / TILE_HEIGHT) // Captured frames are drawn one row tall band at a time, in parallel
+
+// Kinds of draw commands
+#define DRAW_FILL 0
+#define DRAW_OUTLINE 1
+#define DRAW_TEXT 2
+#define DRAW_SPRITE 3
+#define DRAW_CLEAR 4
+#define CHAR_WIDTH 12  // Size of a character of LCD text
+#define CHAR_HEIGHT 17
+#define PALETTE_SIZE 255       // Colors the offscreen frames can use (the sprites only use about 70)
+#define TRANSPARENT 255        // Palette index of see-through sprite pixels
+
+// Animation
+#define SPRITE_FRAMES 4      // Most frames a sprite can have
+#ifndef SPRITE_CACHE_PIXELS
+#define SPRITE_CACHE_PIXELS 4096 // Most sprite pixels loaded at once (every sprite there is now comes to about 1900)
+#endif
+#define FROG_HOP_TIME 0.15   // Seconds the frog shows its hop frame after moving
+#define TURTLE_FPS 2         // Frame rate of turtle diving
+#define WATER_FPS 4          // Frame rate of the water ripple
 
 //-------------------------
 // COLORS
 //-------------------------
 #define LOG_COLOR 0x924A18
 #define WATER_COLOR 0x1042f4
-FEHIMAGE SPRITE_FROG, SPRITE_CAR, SPRITE_TURTLE, SPRITE_LOG, SPRITE_ROAD, SPRITE_GRASS, SPRITE_WATER;
 
-// global variables
-float difficulty;
-int state;
+//-------------------------
+// NUMBERS
+//-------------------------
+// Positions, speeds and times are Scalars. Build with -DFIXED_POINT to make them Q16.16 fixed point instead of
+// floats, for chips without a fast FPU and for results that come out bit for bit the same on every compiler
+// The score is a 64 bit count of thousandths of a point in both, since Q16.16 would overflow a few rows in on Harder
+#ifdef FIXED_POINT
+// Q16.16 fixed point number: 16 bits of whole number and 16 bits of fraction. Only uses integer math
+// Holds about +-32767, so times top out around 9 hours (the world clock starts over with every game)
+class Fixed
+{
+public:
+    constexpr Fixed() : raw(0) {}
+    constexpr Fixed(int v) : raw(v * 65536) {}
+    constexpr Fixed(double v) : raw(int32_t(v * 65536 + (v < 0 ? -0.5 : 0.5))) {} // Rounded, only used for constants and input
+    static Fixed FromRaw(int32_t r)
+    {
+        Fixed f;
+        f.raw = r;
+        return f;
+    }
+    explicit operator int() const { return raw / 65536; } // Rounds toward zero like a float cast
+    explicit operator float() const { return raw / 65536.0f; }
+    explicit operator double() const { return raw / 65536.0; }
+
+    friend Fixed operator+(Fixed a, Fixed b) { return FromRaw(a.raw + b.raw); }
+    friend Fixed operator-(Fixed a, Fixed b) { return FromRaw(a.raw - b.raw); }
+    friend Fixed operator*(Fixed a, Fixed b) { return FromRaw(int32_t(int64_t(a.raw) * b.raw / 65536)); }
+    friend Fixed operator/(Fixed a, Fixed b) { return FromRaw(int32_t(int64_t(a.raw) * 65536 / b.raw)); }
+    Fixed operator-() const { return FromRaw(-raw); }
+    Fixed &operator+=(Fixed b) { raw += b.raw; return *this; }
+    Fixed &operator-=(Fixed b) { raw -= b.raw; return *this; }
+    friend bool operator<(Fixed a, Fixed b) { return a.raw < b.raw; }
+    friend bool operator>(Fixed a, Fixed b) { return a.raw > b.raw; }
+    friend bool operator<=(Fixed a, Fixed b) { return a.raw <= b.raw; }
+    friend bool operator>=(Fixed a, Fixed b) { return a.raw >= b.raw; }
+    friend bool operator==(Fixed a, Fixed b) { return a.raw == b.raw; }
+    friend bool operator!=(Fixed a, Fixed b) { return a.raw != b.raw; }
+
+    int32_t raw;
+};
+typedef Fixed Scalar;
+typedef Fixed Seconds;
+
+// Where something moving at speed v is after elapsed seconds, wrapped around the track. Done in 64 bits so long
+// times can't overflow, and wrapped with an integer modulo
+inline Scalar trackPosition(Scalar x, Scalar v, Seconds elapsed)
+{
+    const int64_t track = int64_t(SCREEN_WIDTH) * 65536;
+    int64_t raw = (x.raw + int64_t(v.raw) * elapsed.raw / 65536) % track;
+    if (raw < 0)
+        raw += track;
+    return Scalar::FromRaw(int32_t(raw));
+}
+
+// Thousandths of a point gained over dt seconds at a rate in points per second, rounded to the nearest
+inline int64_t scoreOver(int rate, Seconds dt)
+{
+    return (int64_t(rate) * SCORE_SCALE * dt.raw + 32768) >> 16;
+}
+#else
+typedef float Scalar;
+typedef double Seconds; // Doubles so positions stay precise however long the world runs
+
+// Where something moving at speed v is after elapsed seconds, wrapped around the track
+inline Scalar trackPosition(Scalar x, Scalar v, Seconds elapsed)
+{
+    float pos = fmod(x + v * elapsed, SCREEN_WIDTH);
+    if (pos < 0)
+        pos += SCREEN_WIDTH;
+    return pos;
+}
+
+// Thousandths of a point gained over dt seconds at a rate in points per second, rounded to the nearest
+inline int64_t scoreOver(int rate, Seconds dt)
+{
+    return llround(double(rate) * SCORE_SCALE * dt);
+}
+#endif
+
+// Settings for one game. Presets are built at compile time and only ever copied, so separate games never share anything mutable
+struct GameConfig
+{
+    Scalar difficulty; // Multiplier for obstacle speeds
+    int row_points;    // Points for moving up a row, 1000 * difficulty^2 (worked out once instead of every move)
+    int road_chance;  // Percent chance that a new stretch of rows is road instead of water
+};
+
+constexpr GameConfig makeConfig(double difficulty)
+{
+    return {Scalar(difficulty), int(1000 * difficulty * difficulty + 0.5), 50};
+}
+
+// Difficulty presets picked from the menu
+const GameConfig PRESETS[4] = {
+    makeConfig(0.4), // Easy
+    makeConfig(0.8), // Medium
+    makeConfig(1.3), // Hard
+    makeConfig(2.0), // Harder :)
+};
+
+// Flat copy of an obstacle. No pointers, so snapshots can be copied around with memcpy
+struct EntityState
+{
+    Scalar xpos, velocity;
+    unsigned char kind, width;
+};
+
+// Flat copy of a row and its obstacles
+struct RowState
+{
+    unsigned char kind, variant, num_entities;
+    EntityState entities[SNAPSHOT_ENTITIES];
+};
+
+// Flat copy of a whole game. Forking a game is just copying one of these
+// Rows below first_row are brought back as grass, they're too far below the frog for it to get back to in practice
+struct GameSnapshot
+{
+    int frog_row, first_row, num_rows;
+    Scalar frog_x;
+    int64_t score; // Thousandths of a point
+    Seconds time, frog_hop_time; // World clock, for animations
+    GameConfig config;
+    RowState rows[SNAPSHOT_ROWS];
+};
 
 //------------
 // CLASSES
 //------------
 
+// Live bytes, peak bytes and allocation counts for each MEM_ tag, plus allocations per frame
+// Does nothing unless built with MEMORY_STATS
+class MemoryStats
+{
+public:
+    void Allocated(int tag, long bytes);
+    void Freed(int tag, long bytes);
+    void NewFrame(void); // A frame is done, start counting the next one's allocations
+    void Report(void);   // Print everything so far
+    long Live(int tag)   // Bytes in use under a tag right now
+    {
+        return live[tag];
+    }
+    long Peak(int tag) // Most bytes ever in use under a tag
+    {
+        return peak[tag];
+    }
+    long LastFrameAllocations(void) // Allocations during the last finished frame
+    {
+        return last_frame_allocations;
+    }
+
+private:
+    void RaisePeak(std::atomic<long> &peak, long now); // Raise a peak to now if it's higher
+    std::atomic<long> live[MEM_TAGS], peak[MEM_TAGS], allocations[MEM_TAGS];
+    std::atomic<long> live_total, peak_total;
+    std::atomic<long> frame_allocations, last_frame_allocations, max_frame_allocations, frames, frame_allocations_total;
+};
+
+MemoryStats MEMORY;
+
+#if MEMORY_STATS
+thread_local int memory_tag = MEM_OTHER; // Tag given to allocations made on this thread right now
+
+void *trackedAlloc(size_t size, int tag); // Allocate and count under a tag
+void trackedFree(void *);                 // Free and uncount something from trackedAlloc
+
+// Tags everything allocated on this thread while it's alive
+class MemoryScope
+{
+public:
+    MemoryScope(int tag)
+    {
+        old_tag = memory_tag;
+        memory_tag = tag;
+    }
+    ~MemoryScope()
+    {
+        memory_tag = old_tag;
+    }
+
+private:
+    int old_tag;
+};
+#else
+// Nothing is tracked, so there's nothing to tag
+class MemoryScope
+{
+public:
+    MemoryScope(int) {}
+};
+#endif
+
+// Every color used offscreen. Frames and sprites store one byte per pixel indexing into this, and are only turned
+// back into full colors when a frame is written out
+// Index can be called from any thread. Any entry Index has returned can be read without locking, since it never changes
+class Palette
+{
+public:
+    unsigned char Index(unsigned int color); // Palette index of a color, adding it if there's room
+    unsigned int colors[PALETTE_SIZE];       // 0xRRGGBB, entries never change once added
+
+private:
+    int count = 0;
+    int last = 0; // Most colors are looked up over and over
+#ifdef BOGGER_THREADS
+    std::mutex mutex; // Sprites load on whichever thread first needs them, and pipelined builds draw on their own thread
+#endif
+};
+
+Palette PALETTE;
+
+// Writes captured frames to disk. Frames come from a small pool of reusable buffers, and are encoded on a
+// background thread when there is one, so the game only ever waits on a buffer copy
+class FrameCapture
+{
+public:
+    FrameCapture(int mode);
+    ~FrameCapture();              // Finishes writing every queued frame
+    unsigned char *Acquire(void); // Get an empty frame buffer, NULL if they're all still waiting to be encoded
+    void Submit(unsigned char *); // Queue a finished frame for encoding
+    int frames_written = 0, frames_skipped = 0;
+
+private:
+    void Encode(unsigned char *);
+    int mode;
+    FILE *stream = NULL; // Raw video output
+    unsigned char row_bytes[CAPTURE_WIDTH * 3];
+    std::vector<unsigned char> buffers[CAPTURE_BUFFERS]; // Palette indexes
+    std::vector<unsigned char *> free_buffers, queued_buffers;
+#ifdef BOGGER_THREADS
+    void Work(void); // Encoder thread loop
+    std::thread encoder;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool quit = false;
+#endif
+};
+
+// Image loaded from .pic files, one file per animation frame. Frames are only loaded when SpriteCache first hands the
+// sprite out, so a draw that misses the cache reads the SD card and allocates. Generate and Reset fetch the sprites
+// their rows need ahead of time to keep that out of drawing. Drawn to the LCD with FEHIMAGE, with a copy of the pixels
+// for offscreen frames
+class Sprite
+{
+public:
+    void Open(const char *file_path); // Add the next frame. It's read from the SD card when the sprite is first needed
+    void Draw(int top, int left, int frame = 0);
+    void Load(void);   // Read every frame from the SD card
+    void Unload(void); // Free every frame until it's needed again
+    int FrameAt(Seconds time, int fps) // Frame showing at a time, looping through all of them
+    {
+        return int(time * fps) % num_frames;
+    }
+    int width = 0, height = 0, num_frames = 0;
+    std::vector<unsigned char> pixels; // Palette indexes row by row, every frame one after another
+    FEHIMAGE images[SPRITE_FRAMES];   // One per frame
+    const char *paths[SPRITE_FRAMES]; // File each frame comes from
+    bool opaque[SPRITE_FRAMES];       // Whether a frame has no see-through pixels, so it hides whatever is under it
+    bool loaded = false;
+    unsigned int last_used = 0; // When the cache last handed this sprite out
+};
+
+// Loads sprites the first time they're used and keeps at most SPRITE_CACHE_PIXELS of them in memory,
+// freeing the ones that have gone unused the longest to make room
+class SpriteCache
+{
+public:
+    void Fetch(Sprite *); // Make sure a sprite is loaded, and mark it as just used
+    void NewFrame(void);  // Sprites fetched before now can be freed again
+    int loads = 0, evictions = 0;
+
+private:
+    std::vector<Sprite *> resident; // Loaded sprites
+    int used = 0;                   // Pixels loaded
+    unsigned int clock = 0;         // Counts fetches, for finding the least recently used
+    unsigned int frame_start = 0;   // Sprites used after this are still waiting to be drawn offscreen, so they stay
+#ifdef BOGGER_THREADS
+    std::mutex mutex; // Hosted sessions generate rows on worker threads
+#endif
+};
+
+// One thing to draw, in screen pixels
+struct DrawCommand
+{
+    unsigned char kind;        // DRAW_FILL, DRAW_OUTLINE, DRAW_TEXT, DRAW_SPRITE or DRAW_CLEAR
+    bool culled;               // Left out, it's hidden or already drawn
+    int x, y, w, h;            // For text, roughly the area it covers
+    unsigned int color;        // 0xRRGGBB for the LCD
+    unsigned char color_index; // Palette index for captured frames
+    Sprite *sprite;
+    int sprite_frame;
+    int text; // Where the text starts in the frame's text buffer
+};
+
+// Everything is drawn through here instead of straight to the LCD, so frames can also be captured offscreen
+// Draws are only recorded until the frame is presented. Then the commands get cleaned up:
+//   - fills and sprites hidden under later fills and solid sprites are culled
+//   - repeats of the command just before are dropped, and touching fills of the same color are merged
+//   - runs of fills, outlines and text that don't overlap are sorted by color to save color changes
+// and sent to the LCD once. Captured frames are drawn from the same commands a band at a time, in parallel.
+// Bands don't overlap, so they can all write into the same buffer without locking
+class Canvas
+{
+public:
+    void SetFontColor(unsigned int);
+    void FillRectangle(int, int, int, int);
+    void DrawRectangle(int, int, int, int);
+    void WriteAt(const char *, int, int); // Text only goes to the LCD, captured frames leave it out
+    void DrawSprite(Sprite *, int top, int left, int sprite_frame);
+    void Clear(void);
+    void Present(void); // The frame is done, send it to the capture
+    void SetLCD(bool on) // Turn off drawing to the LCD for headless runs
+    {
+        lcd_on = on;
+    }
+    void StartCapture(FrameCapture *new_capture)
+    {
+        capture = new_capture;
+        color_index = PALETTE.Index(color);
+    }
+
+private:
+    void Record(unsigned char kind, int x, int y, int w, int h, Sprite *sprite = NULL, int sprite_frame = 0, int text = 0);
+    bool Clip(const DrawCommand &, int *x, int *y, int *x_end, int *y_end); // Part of a command on screen, false if none
+    bool Covered(int x, int y, int x_end, int y_end);                        // Whether every pixel is marked as hidden
+    void Cover(int x, int y, int x_end, int y_end);                          // Mark pixels as hidden
+    void Cull(void);       // Drop hidden and repeated commands and merge fills
+    void SendToLCD(void);  // Draw the commands that are left on the LCD, sorted to save color changes
+    void DrawBand(int band); // Draw every command that touches one band into the captured frame
+    bool lcd_on = true;
+    unsigned int color = WHITE;
+    unsigned char color_index = PALETTE.Index(WHITE);
+    FrameCapture *capture = NULL;
+    unsigned char *frame = NULL; // Captured frame being drawn
+    std::vector<DrawCommand> commands;           // Everything drawn this frame, in order
+    std::vector<char> text;                      // Every string written this frame, one after another
+    std::vector<int> order, run;                 // Order commands are sent to the LCD in
+    std::vector<int> band_commands[RENDER_BANDS]; // Indexes of the commands that touch each band
+    unsigned int covered[SCREEN_HEIGHT][SCREEN_WIDTH / 32]; // One bit per pixel hidden by a later command
+};
+
+// Watches how long drawing each frame takes and picks how much drawing to do
+class Quality
+{
+public:
+    Quality(int fps)
+    {
+        budget = 1.0 / fps;
+    }
+    void Begin(void); // Start timing a frame
+    void End(void);   // Stop timing a frame and change level if it has been over or under for long enough
+    int Level(void)
+    {
+        return level;
+    }
+    bool RefreshHUD(void) // Whether the HUD should be redrawn this frame
+    {
+        return level < QUALITY_LOW || frame % HUD_REFRESH == 0;
+    }
+    void HUDCleared(void) // The whole screen was cleared, so the HUD has to be redrawn next frame
+    {
+        frame = -1;
+    }
+    int changes = 0; // Times the level has changed
+
+private:
+    double budget, start = 0; // Seconds
+    int level = QUALITY_FULL, over = 0, under = 0, frame = 0;
+};
+
+Canvas SCREEN;
+SpriteCache SPRITES;
+Quality QUALITY(TARGET_FPS);
+Sprite SPRITE_FROG, SPRITE_CAR, SPRITE_TURTLE, SPRITE_LOG, SPRITE_ROAD, SPRITE_GRASS, SPRITE_WATER;
+
 // Scoreboard display
 class Scoreboard
 {
 private:
-    float score;
-    char cscore[20], chighscore[20];
+    int64_t score; // Thousandths of a point
     int old_score, highscore;
-    std::vector<int> old_scores;
+    int scores_read = 0; // Scores read from the scores file, the last one twice. Counted instead of kept, so a Scoreboard is cheap to copy into every frame
+    GameConfig config;
 
 public:
     Scoreboard(void)
     {
         score = 0;
+        highscore = 0;
+        config = PRESETS[1];
+    }
+    void SetConfig(GameConfig new_config)
+    {
+        config = new_config;
     }
     void AddRow()
     {
-        score += 1000 * difficulty * difficulty;
+        score += int64_t(config.row_points) * SCORE_SCALE;
     }
-    void RemTime(float dt)
+    void RemTime(Scalar dt)
     {
-        score -= 200 * dt;
+        score -= scoreOver(TIME_PENALTY, dt);
         if (score < 0)
             score = 0; // Keep score from going below zero
     }
     void RemRow(void)
     {
-        score -= 1000 * difficulty * difficulty;
+        score -= int64_t(config.row_points) * SCORE_SCALE;
+    }
+    int64_t GetScore(void) // Whole points
+    {
+        return score / SCORE_SCALE;
     }
-    float GetScore(void)
+    int64_t GetExactScore(void) // Thousandths of a point
     {
         return score;
     }
@@ -86,47 +652,53 @@ public:
     }
     float GetGamesPlayed(void)
     {
-        return old_scores.size() - 1;
+        return scores_read == 0 ? 0 : scores_read - 1; // No scores file yet means none played
     }
     void Draw(void)
     {
-        LCD.SetFontColor(WHITE);
-        sprintf(cscore, "Score: %07d", int(score));
+        if (!QUALITY.RefreshHUD())
+            return; // The renderer is behind and left last frame's HUD on the LCD
+        char cscore[20], chighscore[20];
+        SCREEN.SetFontColor(WHITE);
+        sprintf(cscore, "Score: %07d", int(GetScore()));
         sprintf(chighscore, "Highscore: %07d", highscore);
-        if (int(score) > highscore)
-            LCD.SetFontColor(GOLD);
-        LCD.WriteAt(cscore, SCREEN_WIDTH - 174, 26);
-        if (int(score) > highscore)
-            LCD.SetFontColor(WHITE);
-        LCD.WriteAt(chighscore, SCREEN_WIDTH - 222, 6);
+        if (GetScore() > highscore)
+            SCREEN.SetFontColor(GOLD);
+        SCREEN.WriteAt(cscore, SCREEN_WIDTH - 174, 26);
+        if (GetScore() > highscore)
+            SCREEN.SetFontColor(WHITE);
+        SCREEN.WriteAt(chighscore, SCREEN_WIDTH - 222, 6);
     }
     void Reset(void)
     {
         score = 0;
     }
+    void SetExactScore(int64_t new_score)
+    {
+        score = new_score;
+    }
     void Load(const char file_path[99])
     {
-        old_scores.clear(); // Wipe the current vector
+        MemoryScope scope(MEM_SCORES);
+        scores_read = 0; // Count the scores over again
 
         FEHFile *highscores_in = SD.FOpen(file_path, "r"); // Open for reading
         int tmp = 0;
         while (!SD.FEof(highscores_in)) // While there are new scores to scan in
         {
             SD.FScanf(highscores_in, "%d", &tmp); // Scan the score
-            old_scores.push_back(tmp);            // Add the score to the list
-        }
-        SD.FClose(highscores_in);  // Close the input file
-        if (old_scores.size() > 0) // Avoid out of range refrencing
-        {
-            highscore = *std::max_element(old_scores.begin(), old_scores.end()); // Loop through vector and find the max
+            if (scores_read == 0 || tmp > highscore)
+                highscore = tmp; // Keep the max as they're read
+            scores_read++;
         }
+        SD.FClose(highscores_in); // Close the input file
     }
     void Save(const char file_path[99])
     {
         if (score > 0)
         {
             FEHFile *highscores_out = SD.FOpen(file_path, "a"); // Open file for appending
-            SD.FPrintf(highscores_out, "%d\n", int(score));     // Write the current score to the file
+            SD.FPrintf(highscores_out, "%d\n", int(GetScore())); // Write the current score to the file
             SD.FClose(highscores_out);                          // Close the output file
         }
     }
@@ -140,52 +712,272 @@ public:
     {
         // State of the game. 0: main menu, 1: playing the game, 2: displaying statistics, 3:displaying instructions, 4: quitting
         state = 0;
+        config = PRESETS[1];
     }
     void Draw(int, float, float, Scoreboard *);
     int Update(int, int, float x, float y);
+    int GetState(void)
+    {
+        return state;
+    }
+    GameConfig GetConfig(void) // Settings for the difficulty picked last
+    {
+        return config;
+    }
+
+private:
+    int state;
+    GameConfig config;
+};
+
+#ifdef BOGGER_THREADS
+// Pool of worker threads that split a range of work into chunks. The calling thread helps out, so Run() blocks until every chunk is done
+// Only one job is split at a time. A Run() from another thread while one is going, or from inside a job, does all its work itself
+class WorkerPool
+{
+public:
+    WorkerPool()
+    {
+        int cores = std::thread::hardware_concurrency();
+        for (int i = 1; i < cores; i++)
+        { // One worker per extra core
+            workers.push_back(std::thread(&WorkerPool::Work, this));
+        }
+    }
+    void Run(int count, std::function<void(int, int)> fn)
+    {
+        if (workers.empty() || count < 2 || running.exchange(true))
+        { // Nothing to split, or the workers are taken
+            fn(0, count);
+            return;
+        }
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            job = fn;
+            job_count = count;
+            chunk = count / (4 * (workers.size() + 1)) + 1; // A few chunks per thread so uneven rows still balance out
+            next_chunk = 0;
+            busy = workers.size();
+            generation++;
+        }
+        wake.notify_all();
+        RunChunks(); // Help out instead of waiting around
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]
+                  { return busy == 0; });
+        running = false;
+    }
+    ~WorkerPool()
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wake.notify_all();
+        for (std::thread &t : workers)
+        {
+            t.join();
+        }
+    }
+
+private:
+    void RunChunks() // Grab chunks until there are none left
+    {
+        int first;
+        while ((first = next_chunk.fetch_add(chunk)) < job_count)
+        {
+            job(first, std::min(first + chunk, job_count));
+        }
+    }
+    void Work() // Worker thread loop
+    {
+        int seen = 0;
+        while (1)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]
+                          { return quit || generation != seen; });
+                if (quit)
+                    return;
+                seen = generation;
+            }
+            RunChunks();
+            std::unique_lock<std::mutex> lock(mutex);
+            if (--busy == 0)
+                done.notify_one();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    std::function<void(int, int)> job;
+    std::atomic<int> next_chunk;
+    int job_count = 0, chunk = 1, busy = 0, generation = 0;
+    bool quit = false;
+    std::atomic<bool> running{false}; // A job is being split
+};
+WorkerPool WORKERS;
+#endif
+
+// Runs job(first, last) over chunks of [0, count), spread across the worker threads when they exist
+void parallelFor(int count, std::function<void(int, int)> job)
+{
+#ifdef BOGGER_THREADS
+    WORKERS.Run(count, job);
+#else
+    job(0, count);
+#endif
+}
+
+// Records deaths into fixed column buffers and appends them to a file a block at a time
+// Block layout: magic, count, then count values of each column in the order they're declared below
+class Telemetry
+{
+public:
+    Telemetry(const char *new_path)
+    {
+        path = new_path;
+    }
+    ~Telemetry()
+    {
+        Flush();
+    }
+    // Add one death. Just a few stores unless the block is full
+    void Record(unsigned char cause, int row, unsigned char row_kind, unsigned char row_variant, float time, float difficulty, float frame_time)
+    {
+#ifdef BOGGER_THREADS
+        std::lock_guard<std::mutex> lock(mutex); // Hosted games can share one
+#endif
+        times[count] = time;
+        difficulties[count] = difficulty;
+        frame_times[count] = frame_time;
+        rows[count] = row;
+        causes[count] = cause;
+        row_kinds[count] = row_kind;
+        row_variants[count] = row_variant;
+        if (++count == TELEMETRY_BLOCK)
+            Write();
+    }
+    void Flush(void) // Write out whatever is waiting
+    {
+#ifdef BOGGER_THREADS
+        std::lock_guard<std::mutex> lock(mutex);
+#endif
+        Write();
+    }
+
+private:
+    void Write(void);
+    const char *path;
+    unsigned int count = 0;
+    float times[TELEMETRY_BLOCK];        // World clock at the time of death (seconds)
+    float difficulties[TELEMETRY_BLOCK]; // Obstacle speed multiplier
+    float frame_times[TELEMETRY_BLOCK];  // Length of the frame the frog died in (seconds)
+    int rows[TELEMETRY_BLOCK];           // Row the frog died in
+    unsigned char causes[TELEMETRY_BLOCK];       // DEATH_WATER or DEATH_CAR
+    unsigned char row_kinds[TELEMETRY_BLOCK];    // KIND_GRASS, KIND_ROAD or KIND_WATER
+    unsigned char row_variants[TELEMETRY_BLOCK]; // Water layout (1-4), 0 for other rows
+#ifdef BOGGER_THREADS
+    std::mutex mutex;
+#endif
+};
+
+// Follows each touch by ID through the frame loop and keeps how long it took to reach every stage
+// Frames are numbered as they're published, and a touch counts as drawn with the first frame drawn at or after the
+// one it was published in, so touches in frames the renderer skipped still finish
+// Does nothing unless built with LATENCY_TRACE
+class LatencyTracer
+{
+public:
+    int Touch(void);               // Start tracing a touch that was just read, returns its ID
+    void Mark(int id, int stage);  // A traced touch became a move or was simulated (IDs below zero are ignored)
+    void Shown(int id, int frame); // A traced touch is in a published frame
+    void Drawn(int frame);         // A frame was drawn, along with every touch published in it or before it
+    void Present(void);            // The frame is done. Finishes every drawn touch and drops ones that never became moves
+    void Report(void);             // Print latency percentiles for each stage, then start over. Waits until every touch
+                                   // so far has been presented, so the last moves of a game are in its own report
+
+private:
+    void ReportIfDone(void);
+    struct Trace
+    {
+        int id;
+        int frame;                   // Frame it was published in, 0 until it is
+        double touch_time;           // Seconds
+        double times[TRACE_STAGES];  // Seconds, 0 until reached
+    };
+    std::vector<Trace> pending;
+    std::vector<float> latencies[TRACE_STAGES]; // Milliseconds from the touch to each stage, for finished touches
+    int next_id = 0;
+    int report_before = -1; // A report is waiting on touches with IDs below this, -1 if none is
+#ifdef BOGGER_THREADS
+    std::mutex mutex; // Pipelined builds trace from both the game and render threads
+#endif
 };
 
 // Object with spacial coordinates, a horizontal velocity, width, and height
 class Entity
 {
 public:
-    Entity(float x, float y, float v, float w, float h = TILE_HEIGHT)
+    Entity(Scalar x, Scalar y, Scalar v, Scalar w, Scalar h = TILE_HEIGHT)
     {
         xpos = x;                  // px
         ypos = y;                  // px
-        velocity = difficulty * v; // px/sec
+        velocity = v;              // px/sec
         width = w;                 // px
         height = h;                // px
     }
-    void Update(float);
-    float getXpos();
-    float getYpos();
-    float getWidth();
-    float getVelocity();
+    void SetClock(const Seconds *);
+    Scalar getXpos();
+    Scalar getYpos();
+    Scalar getWidth();
+    Scalar getVelocity();
+    void Set(Scalar, Scalar);
     virtual void Draw(int){};
     virtual ~Entity(){};
+#if MEMORY_STATS
+    static void *operator new(size_t size)
+    {
+        return trackedAlloc(size, MEM_ENTITIES);
+    }
+    static void operator delete(void *ptr)
+    {
+        trackedFree(ptr);
+    }
+#endif
 
 protected:
+    Seconds Time() // Current time on the Entity's clock
+    {
+        return clock ? *clock : 0;
+    }
     // Xpos and Ypos correspond to the coordinates of the tile the Entitys is located. (0,0) is the top left corner.
-    float xpos, ypos;
+    // Xpos is where the Entity was at start_time, getXpos() works out where it is now from the clock
+    Scalar xpos, ypos;
+    // Clock the Entity moves by (owned by the world) and the time xpos was measured at. No clock means it stays put
+    const Seconds *clock = NULL;
+    Seconds start_time = 0;
     // Speed at which the Entitys is moving. Positive number left -> right. Negative number for right -> left.
-    float velocity;
+    Scalar velocity;
     // Width and Height represent the bounding box of the object, and can be used to draw a simple representation
-    float width, height;
+    Scalar width, height;
 };
 
 // Row object. Holds pointers to obstacles and background entities
 class Row
 {
 public:
-    std::vector<Entity *> getEntities();
+    const std::vector<Entity *> &getEntities();
 
-    // Update all objects in the row
-    void Update(float dt)
+    // Set the clock all objects in the row move by
+    void SetClock(const Seconds *new_clock)
     {
+        clock = new_clock;
         for (Entity *e : row_elements)
-        { // update all elements in the world_elements vector
-            e->Update(dt);
+        {
+            e->SetClock(clock);
         }
     }
 
@@ -199,7 +991,10 @@ public:
 
     void AddElement(Entity *elem) // Add an object to a row by pointer
     {
+        MemoryScope scope(MEM_ROWS);
         row_elements.push_back(elem); //"Push" the pointer "elem" to the "back" of the vector
+        if (clock)
+            elem->SetClock(clock); // Move with the rest of the row
     }
 
     void RemElement(Entity *elem) // Remove an obstacle by pointer
@@ -213,6 +1008,24 @@ public:
         delete elem;                                                                                         // free elem from memory
     }
 
+    int GetVariant() // Layout the row was built with
+    {
+        return variant;
+    }
+    void SetVariant(int new_variant)
+    {
+        variant = new_variant;
+    }
+#if MEMORY_STATS
+    static void *operator new(size_t size)
+    {
+        return trackedAlloc(size, MEM_ROWS);
+    }
+    static void operator delete(void *ptr)
+    {
+        trackedFree(ptr);
+    }
+#endif
     virtual ~Row()
     { // If a row is deleted, make sure to delete all of its contained objects too
         for (Entity *e : row_elements)
@@ -221,8 +1034,16 @@ public:
         }
     }
 
+protected:
+    Seconds Time() // Current time on the row's clock
+    {
+        return clock ? *clock : 0;
+    }
+    int variant = 0; // Layout the row was built with (1-4 for Water, 0 for everything else)
+
 private:
     std::vector<Entity *> row_elements; // list of things like the background and any obstacles
+    const Seconds *clock = NULL;
 };
 
 // Game state object. Amalgamation of all the rows and other entities required to make the game run. (besides the frog)
@@ -230,7 +1051,7 @@ private:
 class World
 {
 public:
-    void Update(int, float);                         // Update all rows in the frame
+    void Update(Scalar);                             // Move the world clock forward
     void Draw(int);                                  // Draw all rows in the frame
     void addToRow(int, Entity *);                    // Adds an entity object to the desired row
     void removeFromRow(int, Entity *);               // Removes an entity object to the desired row
@@ -239,25 +1060,57 @@ public:
     {
         return typeid(*world_elements.at(row)).name();
     }
+    int GetRowVariant(int row)
+    {
+        return world_elements.at(row)->GetVariant();
+    }
+    Seconds GetTime(void)
+    {
+        return time;
+    }
+    int NumRows(void)
+    {
+        return world_elements.size();
+    }
 
     void AddRow(Row *elem) // Add a row at the top of the screen by pointer
     {
+        MemoryScope scope(MEM_WORLD);
         world_elements.push_back(elem); //"Push" the pointer "elem" to the "back" of the vector
+        elem->SetClock(&time);          // Everything in the row moves by the world clock from now on
     }
 
     void Generate(int new_total_rows); // Add random rows up to a passed number
 
+    void SetConfig(GameConfig new_config) // Settings used for newly generated rows
+    {
+        config = new_config;
+    }
+    GameConfig GetConfig(void)
+    {
+        return config;
+    }
+
     void RemRow(Row *elem) // Add a row by pointer
     {
         world_elements.erase(std::remove(world_elements.begin(), world_elements.end(), elem), world_elements.end()); // Remove pointer "elem" from vector of pointers to rows
         delete elem;                                                                                                 // free elem from memory
     }
 
-    void Reset()
+    void Reset() // Delete every row (the frog must already be removed)
     {
+        for (Row *e : world_elements)
+        {
+            delete e;
+        }
         world_elements.clear();
+        time = 0; // Start the clock over too, so it never runs long enough to overflow in fixed point
     }
 
+    void Observe(int, int, unsigned char *); // Fill in a grid of what's in each tile, OBS_COLS tiles across, for a number of rows starting at a row
+    bool Save(GameSnapshot *, Entity *);  // Copy the rows around the frog into a snapshot, skipping the frog itself. False if they didn't all fit
+    void Load(const GameSnapshot *);      // Replace every row with the ones in a snapshot
+
     ~World() // If the gamestate is deleted, make sure to delete all of the rows too
     {
         for (Row *e : world_elements)
@@ -267,7 +1120,10 @@ public:
     }
 
 private:
+    void ObserveRows(int start_row, int first, int last, unsigned char *cells); // Rows first to last of an Observe
     std::vector<Row *> world_elements;
+    GameConfig config = PRESETS[1];
+    Seconds time = 0; // Seconds the world has been running, every obstacle position is worked out from this
 };
 
 // Frog class, Main Entity
@@ -275,13 +1131,30 @@ class Frog : public Entity
 {
     // TODO:
 public:
-    Frog(int x, int y, float v, float w) : Entity(x, y, v, w) {}
+    Frog(int x, int y, Scalar v, Scalar w) : Entity(x, y, v, w) {}
     void Draw(int row);
-    void Move(float, float);
+    static void DrawAt(int row, Scalar x, Seconds since_hop);
+    void Move(Scalar, Scalar);
+    void Hop() // Start the hop animation
+    {
+        hop_time = Time();
+    }
+    Seconds GetHopTime()
+    {
+        return hop_time;
+    }
+    void SetHopTime(Seconds new_hop_time)
+    {
+        hop_time = new_hop_time;
+    }
     void Reset()
     {
         xpos = SCREEN_WIDTH / 2;
+        hop_time = -FROG_HOP_TIME; // The world clock starts over, so forget the last hop
     }
+
+private:
+    Seconds hop_time = -FROG_HOP_TIME; // Time of the last hop
 };
 
 // Turtle Class, Obstacle in Water
@@ -289,8 +1162,9 @@ class Turtle : public Entity
 {
     // TODO:
 public:
-    Turtle(int x, float v, float w, float h = 14.0) : Entity(x, 0, v, w, h) {}
+    Turtle(int x, Scalar v, Scalar w, Scalar h = 14) : Entity(x, 0, v, w, h) {}
     void Draw(int row);
+    static void DrawAt(int row, Scalar x, Seconds time);
 };
 
 // Log Class, Obstacle in Water
@@ -298,8 +1172,9 @@ class Log : public Entity
 {
     // TODO:
 public:
-    Log(int x, float v, float w, float h = 14.0) : Entity(x, 0, v, w, h) {}
+    Log(int x, Scalar v, Scalar w, Scalar h = LOG_HEIGHT) : Entity(x, 0, v, w, h) {}
     void Draw(int row);
+    static void DrawAt(int row, Scalar x, Scalar width, Scalar height); // Draw a log without one, for drawing snapshots
 };
 
 // Car Class, Obstacle on Road
@@ -307,8 +1182,9 @@ class Car : public Entity
 {
     // TODO:
 public:
-    Car(int x, int y, float v, float w) : Entity(x, y, v, w) {}
+    Car(int x, int y, Scalar v, Scalar w) : Entity(x, y, v, w) {}
     void Draw(int row);
+    static void DrawAt(int row, Scalar x);
 };
 
 // Road Class, Type of Row in World
@@ -317,14 +1193,16 @@ class Road : public Row
 {
     // TODO:
 public:
-    Road(int type) : Row()
+    Road() : Row() {} // Empty road, filled in by the caller (used when loading snapshots)
+    Road(int type, Scalar difficulty) : Row()
     {
         // todo Add car randomization (using int type)
-        AddElement(new Car(Random.RandInt() % SCREEN_WIDTH, 0, 2, CAR_WIDTH1));   //! TESTING
-        AddElement(new Car(Random.RandInt() % SCREEN_WIDTH, 0, 20, CAR_WIDTH1));  //! TESTING
-        AddElement(new Car(Random.RandInt() % SCREEN_WIDTH, 0, 240, CAR_WIDTH1)); //! TESTING
+        AddElement(new Car(Random.RandInt() % SCREEN_WIDTH, 0, difficulty * 2, CAR_WIDTH1));   //! TESTING
+        AddElement(new Car(Random.RandInt() % SCREEN_WIDTH, 0, difficulty * 20, CAR_WIDTH1));  //! TESTING
+        AddElement(new Car(Random.RandInt() % SCREEN_WIDTH, 0, difficulty * 240, CAR_WIDTH1)); //! TESTING
     }
     void Draw(int row); // Row at which to draw the background (0 = bottom row)
+    static void DrawBackground(int row); // Just the road, for drawing snapshots
 };
 
 // Grass Class, Type of Row in World
@@ -335,6 +1213,7 @@ class Grass : public Row
 public:
     Grass() : Row() {}
     void Draw(int row);
+    static void DrawBackground(int row);
 };
 
 // Water Class, Type of Row in World
@@ -343,15 +1222,17 @@ class Water : public Row
 {
     // TODO:
 public:
-    Water(int type) : Row()
+    Water() : Row() {} // Empty water, filled in by the caller (used when loading snapshots)
+    Water(int type, Scalar difficulty) : Row()
     {
         if (type == 0)
         { // If type zero is passed, randomize the type
             type = (Random.RandInt() % 4) + 1;
         }
+        variant = type;
         int turtle_offset = Random.RandInt() % 16;
-        int x = Random.RandInt() % 120 + 30; // LOG SPEED
-        if (Random.RandInt() % 2)            // 50-50 Positive, Negative Velocity
+        Scalar x = difficulty * (Random.RandInt() % 120 + 30); // LOG SPEED
+        if (Random.RandInt() % 2)                              // 50-50 Positive, Negative Velocity
         {
             x = x * -1;
         }
@@ -372,51 +1253,346 @@ public:
             AddElement(new Log(Random.RandInt() % (SCREEN_WIDTH / 2) + SCREEN_WIDTH / 2, x, LOG_WIDTH3)); // Add Log Entity to Water
             break;
         case 4:                                                         // TBA types
-            AddElement(new Turtle(16 + turtle_offset, 40, TILE_WIDTH)); // Add Turtle Entity to Water
-            AddElement(new Turtle(32 + turtle_offset, 40, TILE_WIDTH)); // Add Turtle Entity to Water
-            AddElement(new Turtle(48 + turtle_offset, 40, TILE_WIDTH)); // Add Turtle Entity to Water
+            AddElement(new Turtle(16 + turtle_offset, difficulty * 40, TILE_WIDTH)); // Add Turtle Entity to Water
+            AddElement(new Turtle(32 + turtle_offset, difficulty * 40, TILE_WIDTH)); // Add Turtle Entity to Water
+            AddElement(new Turtle(48 + turtle_offset, difficulty * 40, TILE_WIDTH)); // Add Turtle Entity to Water
 
-            AddElement(new Turtle(128 + turtle_offset, 40, TILE_WIDTH)); // Add Turtle Entity to Water
-            AddElement(new Turtle(144 + turtle_offset, 40, TILE_WIDTH)); // Add Turtle Entity to Water
-            AddElement(new Turtle(160 + turtle_offset, 40, TILE_WIDTH)); // Add Turtle Entity to Water
+            AddElement(new Turtle(128 + turtle_offset, difficulty * 40, TILE_WIDTH)); // Add Turtle Entity to Water
+            AddElement(new Turtle(144 + turtle_offset, difficulty * 40, TILE_WIDTH)); // Add Turtle Entity to Water
+            AddElement(new Turtle(160 + turtle_offset, difficulty * 40, TILE_WIDTH)); // Add Turtle Entity to Water
 
-            AddElement(new Turtle(240 + turtle_offset, 40, TILE_WIDTH)); // Add Turtle Entity to Water
-            AddElement(new Turtle(256 + turtle_offset, 40, TILE_WIDTH)); // Add Turtle Entity to Water
-            AddElement(new Turtle(272 + turtle_offset, 40, TILE_WIDTH)); // Add Turtle Entity to Water
+            AddElement(new Turtle(240 + turtle_offset, difficulty * 40, TILE_WIDTH)); // Add Turtle Entity to Water
+            AddElement(new Turtle(256 + turtle_offset, difficulty * 40, TILE_WIDTH)); // Add Turtle Entity to Water
+            AddElement(new Turtle(272 + turtle_offset, difficulty * 40, TILE_WIDTH)); // Add Turtle Entity to Water
             break;
         }
     }
     void Draw(int row);
+    static void DrawBackground(int row, Seconds time);
 };
 
-//---------------------
-// Function Prototypes
-//---------------------
-void getDifficulty();
-int getUserInput(float, float, Entity *);
-void endGame(Scoreboard *, World *, int *, Frog *);
-
-//----------------------
-// Main Method
-//----------------------
-int main()
+// Game Class, one complete game
+// Holds the world, the frog and the score. Nothing in here is shared, so many games can run side by side
+class Game
 {
-    // Declare variables for use throughout main
-    float touchx, touchy;
-    bool touched = 0, touched_last_frame = 0;
-    int frog_row = 1;
-    int move;
-    float frog_distance = 160;
-    Entity *collided_object = NULL;
-    Frog *frog = new Frog(frog_distance, SCREEN_HEIGHT - (3 * TILE_HEIGHT), 0, TILE_WIDTH);
-
-    // Create persistent objects
-    World world = World();
-    Menu main_menu = Menu();
-    Scoreboard scoreboard = Scoreboard();
+public:
+    Game()
+    {
+        frog = new Frog(SCREEN_WIDTH / 2, SCREEN_HEIGHT - (3 * TILE_HEIGHT), 0, TILE_WIDTH);
+        frog_row = 2;
+        Reset();
+    }
+    void SetConfig(GameConfig config) // Difficulty settings for the world and the score
+    {
+        world.SetConfig(config);
+        scoreboard.SetConfig(config);
+    }
+    void Reset();                 // Start over on the starting grass rows
+    int Step(int move, Scalar dt); // Move the frog and advance everything by dt. Returns 1 if the frog died
+    void Draw();                  // Draw all rows on screen
+    bool Save(GameSnapshot *);    // Copy the game into a snapshot. False if it didn't all fit
+    void Load(const GameSnapshot *); // Put the game back the way it was in a snapshot
+
+    World world;
+    Scoreboard scoreboard;
+    Frog *frog; // Owned by whichever row it's in
+    int frog_row;
+    Telemetry *telemetry = NULL; // Where deaths get recorded, if anywhere
+};
 
-    // Load sprites
-    SPRITE_FROG.Open("FrogFEH.pic");
+// Moves fed to a hosted session, filled by the host between ticks
+class InputQueue
+{
+public:
+    void Push(int move)
+    {
+        if (count < INPUT_QUEUE_SIZE) // Drop inputs if the session has fallen behind
+        {
+            moves[(first + count) % INPUT_QUEUE_SIZE] = move;
+            count++;
+        }
+    }
+    int Pop(void) // Returns 0 if there's no input waiting
+    {
+        if (count == 0)
+            return 0;
+        int move = moves[first];
+        first = (first + 1) % INPUT_QUEUE_SIZE;
+        count--;
+        return move;
+    }
+
+private:
+    int moves[INPUT_QUEUE_SIZE];
+    int first = 0, count = 0;
+};
+
+// Stand-in for a remote player, taps in a random direction now and then (mostly up)
+class LoopbackInput
+{
+public:
+    LoopbackInput(unsigned int new_seed)
+    {
+        seed = new_seed;
+    }
+    int NextMove(void) // Returns 0 for no input, otherwise a move like getUserInput
+    {
+        seed = seed * 1103515245 + 12345; // Own generator so sessions don't fight over Random
+        int roll = (seed >> 16) % 100;
+        if (roll < 80)
+            return 0; // No tap this tick
+        if (roll < 92)
+            return 1;
+        return (roll % 3) + 2; // right, down or left
+    }
+
+private:
+    unsigned int seed;
+};
+
+// Game over sequence. The main loop moves it along one step per frame, so drawing and input keep running the whole time
+class GameOver
+{
+public:
+    void Start(Game *);                              // The frog died. Save the score and freeze the game
+    void Tick(Scalar dt, bool touched, bool new_touch); // Move the sequence along by one frame
+    void Draw(void);                                 // Draw the death flash and the game over message
+    void Finish(void);                               // Start a new game
+    bool Running(void)
+    {
+        return phase != 0;
+    }
+
+private:
+    int phase = 0; // 0: not running, 1: frog flashing, 2: waiting for the screen to be let go, 3: waiting for a tap
+    Scalar timer = 0;
+    int frog_x = 0; // Where the frog died, for the flashing box
+    Game *game = NULL;
+};
+
+// Holds a loop to a fixed rate. Sleeps through most of the time left in a frame, then spins the last bit so frames stay evenly spaced
+class FramePacer
+{
+public:
+    FramePacer(int fps)
+    {
+        budget = 1.0 / fps;
+        next_frame = TimeNow() + budget;
+    }
+    void Wait(void); // Wait until the next frame is due
+    int overruns = 0; // Frames that took longer than the budget
+
+private:
+    double budget, next_frame; // Seconds
+};
+
+// What gets published to monitors each frame
+struct MetricsSample
+{
+    uint64_t frames;    // Frames published so far
+    double uptime;      // Seconds since the first frame
+    float fps;          // Over the last METRICS_WINDOW frames
+    float frame_ms_p50; // Frame time percentiles over the same frames
+    float frame_ms_p95;
+    float frame_ms_p99;
+    float frame_ms_max;
+    int32_t state; // Menu state, 1 while playing
+    int32_t row;   // Row the frog is on
+    int32_t score;
+    int32_t high_score;
+    int32_t games_played;
+    float difficulty;
+    int64_t memory_live[MEM_TAGS]; // Bytes in use for each MEM_ tag, all zero unless built with MEMORY_STATS
+    int64_t memory_peak[MEM_TAGS];
+    int32_t frame_allocations; // Allocations during the last frame
+};
+
+// Layout of the shared memory. The sample is behind a seqlock: the sequence is odd while it's being written, so
+// readers copy it and only keep the copy if the sequence was even and the same before and after
+// The magic is stored last, so readers that see it can trust everything else in the header
+struct MetricsBlock
+{
+    std::atomic<uint32_t> magic;
+    uint32_t version;
+    std::atomic<uint32_t> sequence;
+    uint32_t pid;
+    MetricsSample sample;
+};
+
+// Publishes a MetricsBlock for monitors once a frame. Readers never block the game, they just retry
+// Does nothing unless built with LIVE_METRICS
+class LiveMetrics
+{
+public:
+    ~LiveMetrics(void);
+    void Publish(int state, int row, Scoreboard *scoreboard, World *world); // Once a frame, from the main loop
+
+private:
+    bool Open(void); // Create the shared memory on the first frame
+    MetricsBlock *block = NULL;
+    bool failed = false;     // Couldn't create it, don't keep trying
+    char name[32];
+    float frame_ms[METRICS_WINDOW]; // Ring of recent frame times
+    uint64_t frames = 0;
+    double start_time, last_time;
+};
+
+LiveMetrics METRICS;
+
+#ifdef PIPELINE
+// Everything needed to draw one frame, copied out of the live game so it can be drawn while the game moves on
+struct FrameState
+{
+    Menu menu;
+    GameOver game_over;
+    Scoreboard scoreboard;
+    GameSnapshot game; // Only filled in while playing
+    bool touched;
+    float touchx, touchy;
+    int number; // Frames are numbered in the order they're published
+};
+
+// Three FrameStates passed from one thread to another. The writer always has a slot of its own to fill and never
+// waits on the reader, the reader always gets the newest finished frame, and frames the reader was too slow for are skipped
+class FrameBuffer
+{
+public:
+    FrameState *Back(void) // Slot for the writer to fill
+    {
+        return &slots[back];
+    }
+    void Publish(void) // Swap the filled slot for the spare one, and wake the reader
+    {
+        back = spare.exchange(back | FRAME_FRESH) & ~FRAME_FRESH;
+        std::lock_guard<std::mutex> lock(mutex); // So the reader can't miss the wake between checking and waiting
+        fresh.notify_one();
+    }
+    FrameState *Take(void) // Wait for the newest published frame. NULL once the buffer is closed
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        fresh.wait(lock, [this]
+                   { return closed || (spare.load() & FRAME_FRESH); });
+        if (closed)
+            return NULL;
+        front = spare.exchange(front) & ~FRAME_FRESH;
+        return &slots[front];
+    }
+    void Close(void) // Wake the reader for good
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        fresh.notify_one();
+    }
+
+private:
+    FrameState slots[3];
+    int back = 0, front = 1;
+    std::atomic<int> spare{2};
+    std::mutex mutex;
+    std::condition_variable fresh;
+    bool closed = false;
+};
+#endif
+
+// Draws and presents frames. Built with PIPELINE, frames are copied into a FrameBuffer and drawn on a render thread
+// straight from each snapshot, so drawing one frame overlaps simulating the next. The render thread then owns the
+// LCD, so it reads the touchscreen too. Otherwise frames are drawn right away from the live game
+class Renderer
+{
+public:
+    Renderer(LatencyTracer *);
+    ~Renderer();
+    void Publish(Menu *, Game *, GameOver *, bool touched, float touchx, float touchy, int trace); // The frame is simulated, get it on screen
+    bool Touch(float *x, float *y); // Same as LCD.Touch, from whichever thread uses the LCD
+
+private:
+    // Draws the live game, or the saved one if there's no live one
+    void Draw(Menu *, Game *, const GameSnapshot *, Scoreboard *, GameOver *, bool touched, float touchx, float touchy, int number);
+    void DrawSnapshot(const GameSnapshot *); // Draw the rows on screen the same way Game::Draw would
+    LatencyTracer *tracer;
+    int published = 0; // Frames published so far
+#ifdef PIPELINE
+    void Work(void); // Render thread loop
+    FrameBuffer frames;
+    std::thread thread;
+    std::mutex touch_mutex;
+    bool touch_down = false; // Touchscreen as of the last frame presented
+    float touch_x = 0, touch_y = 0;
+#endif
+};
+
+// Per session measurements
+struct SessionStats
+{
+    int ticks, deaths, best_score;
+    double total_step_time, max_step_time; // Seconds spent in Game::Step
+};
+
+// Runs many independent games at a fixed tick rate without a display
+// Sprites are loaded once and only read, so every session shares them
+class SessionHost
+{
+public:
+    SessionHost(int num_sessions, GameConfig config);
+    ~SessionHost();
+    void Run(int num_ticks); // Step every session num_ticks times, sleeping off whatever is left of each tick
+    void Report(void);       // Print per session latency and throughput
+
+private:
+    std::vector<Game *> sessions;
+    std::vector<InputQueue> inputs;
+    std::vector<LoopbackInput> players;
+    std::vector<SessionStats> stats;
+    int overruns = 0; // Ticks that went over budget
+    double run_time = 0;
+};
+
+// Steps many games in lockstep for automated play. Every call writes straight into buffers the caller owns:
+// observations are OBS_SIZE bytes per game, rewards one float per game and dones one byte per game
+// Actions are the same as getUserInput (0: nothing, 1: up, 2: right, 3: down, 4: left)
+class BatchEnv
+{
+public:
+    BatchEnv(int num_envs, GameConfig config, Telemetry *telemetry = NULL);
+    ~BatchEnv();
+    void Reset(unsigned char *observations);
+    void Step(const int *actions, unsigned char *observations, float *rewards, unsigned char *dones); // Finished games start over on their own
+    bool Copy(int from, int to); // Make one game an exact copy of another, for branching searches. False if it couldn't be
+    int Size(void)
+    {
+        return games.size();
+    }
+
+private:
+    std::vector<Game *> games;
+};
+
+//---------------------
+// Function Prototypes
+//---------------------
+void getDifficulty();
+int getUserInput(float, float, Entity *);
+void endGame(Game *);
+void recordDeath(Game *, unsigned char, Scalar);
+int selfTest(void);
+
+//----------------------
+// Main Method
+//----------------------
+int main()
+{
+    // Declare variables for use throughout main
+    float touchx, touchy;
+    bool touched = 0, touched_last_frame = 0;
+    int move;
+
+    if (MEMORY_STATS)
+        atexit([]
+               { MEMORY.Report(); });
+
+    // Name every sprite's files. They're loaded as they're needed
+    SPRITE_FROG.Open("FrogFEH.pic");
+    SPRITE_FROG.Open("Frog2FEH.pic");
     SPRITE_CAR.Open("CarFEH.pic");
     SPRITE_TURTLE.Open("TurtleFEH.pic");
     SPRITE_LOG.Open("LogFEH.pic");
@@ -424,20 +1600,113 @@ int main()
     SPRITE_GRASS.Open("GrassFEH.pic");
     SPRITE_WATER.Open("WaterFEH.pic");
 
+#if CAPTURE_MODE > 0
+    // Record every frame offscreen. Static, so the frames still queued get written when the window is closed: the game
+    // loop never returns, the simulator just calls exit(), and that only cleans up statics
+    static FrameCapture capture(CAPTURE_MODE);
+    SCREEN.StartCapture(&capture);
+#endif
+
+#if BATCH_ENVS > 0
+    {
+        // Benchmark the batch environment with random moves
+        SCREEN.SetLCD(false);
+        Telemetry telemetry(TELEMETRY_PATH);
+        BatchEnv envs(BATCH_ENVS, PRESETS[1], &telemetry);
+        std::vector<unsigned char> observations(BATCH_ENVS * OBS_SIZE), dones(BATCH_ENVS);
+        std::vector<float> rewards(BATCH_ENVS);
+        std::vector<int> actions(BATCH_ENVS);
+        LoopbackInput player(1);
+        int episodes = 0;
+
+        envs.Reset(observations.data());
+        double start_time = TimeNow();
+        for (int step = 0; step < BATCH_STEPS; step++)
+        {
+            for (int i = 0; i < BATCH_ENVS; i++)
+            {
+                actions[i] = player.NextMove();
+            }
+            envs.Step(actions.data(), observations.data(), rewards.data(), dones.data());
+            MEMORY.NewFrame();
+            for (int i = 0; i < BATCH_ENVS; i++)
+            {
+                episodes += dones[i];
+            }
+        }
+        double run_time = TimeNow() - start_time;
+        printf("%d envs x %d steps in %.2f s: %.0f env-steps/s, %d episodes finished\n",
+               BATCH_ENVS, BATCH_STEPS, run_time, BATCH_ENVS * double(BATCH_STEPS) / run_time, episodes);
+        return 0;
+    }
+#endif
+
+#if SELF_TEST
+    SCREEN.SetLCD(false);
+    return selfTest();
+#endif
+
+#if STRESS_ROWS > 0
+    {
+        // Time headless ticks of a huge world, crowded with cars
+        SCREEN.SetLCD(false);
+        World world;
+        for (int i = 0; i < STRESS_ROWS; i++)
+        {
+            Road *road = new Road();
+            for (int j = 0; j < STRESS_ENTITIES; j++)
+            {
+                road->AddElement(new Car(Random.RandInt() % SCREEN_WIDTH, 0, Random.RandInt() % 200 - 100, CAR_WIDTH1));
+            }
+            world.AddRow(road);
+        }
+        std::vector<unsigned char> storage(STRESS_ROWS * OBS_COLS + CACHE_LINE);
+        unsigned char *cells = (unsigned char *)((uintptr_t(storage.data()) + CACHE_LINE - 1) & ~uintptr_t(CACHE_LINE - 1)); // Start on a cache line
+#ifdef BOGGER_THREADS
+        int threads = std::thread::hardware_concurrency();
+#else
+        int threads = 1;
+#endif
+
+        double start_time = TimeNow();
+        for (int tick = 0; tick < STRESS_TICKS; tick++)
+        {
+            world.Update(Scalar(1) / TARGET_FPS);
+            world.Observe(0, STRESS_ROWS, cells);
+        }
+        double run_time = TimeNow() - start_time;
+        printf("%d rows x %d obstacles, %d ticks in %.2f s on %d threads: %.1f ticks/s, %.0f rows/s\n", STRESS_ROWS,
+               STRESS_ENTITIES, STRESS_TICKS, run_time, threads, STRESS_TICKS / run_time, STRESS_ROWS * double(STRESS_TICKS) / run_time);
+        return 0;
+    }
+#endif
+
+#if SESSION_HOST > 0
+    // Host a bunch of headless games instead of playing one
+    SCREEN.SetLCD(false);
+    SessionHost host(SESSION_HOST, PRESETS[1]);
+    host.Run(HOST_TICKS);
+    host.Report();
+    return 0;
+#endif
+
+    // Create persistent objects
+    Game game;
+    Telemetry telemetry(TELEMETRY_PATH);
+    game.telemetry = &telemetry;
+    Menu main_menu = Menu();
+    GameOver game_over;
+    FramePacer pacer(TARGET_FPS);
+    LatencyTracer tracer;
+    int trace = -1; // ID of this frame's touch
+    Renderer renderer(&tracer);
+
     // Load scores
-    scoreboard.Load(SCORES_PATH);
+    game.scoreboard.Load(SCORES_PATH);
 
     // Get inital game time //todo make this a function probably
     int current_frame_time = 0, prev_frame_time = 0; // Intermediary calculation variables for the frame_time (msecs)
-    float frame_time;                                // Time it took for the last frame to render (seconds)
-
-    // Initalize the world with the three starting rows
-    world.AddRow(new Grass);
-    world.AddRow(new Grass);
-    world.AddRow(new Grass);
-
-    // Add frog to starting row
-    world.addToRow(2, frog);
+    Scalar frame_time;                               // Time it took for the last frame to render (seconds)
 
     // Infinite update loop
     while (1)
@@ -445,7 +1714,7 @@ int main()
         // Time updates
         prev_frame_time = current_frame_time;
         current_frame_time = TimeNowMSec();
-        frame_time = (current_frame_time - prev_frame_time) / 1000.; // Calculate the time the last frame took (in ms) for velocity calculations
+        frame_time = Scalar(current_frame_time - prev_frame_time) / 1000; // Calculate the time the last frame took (in ms) for velocity calculations
 
         // Prevent touchscreen input from freezing the program or repeating on a held mouse press
         if (touched)
@@ -453,158 +1722,57 @@ int main()
         else
             touched_last_frame = false;
         // Get the user input for this loop (only once instead of calling it in each method)
-        touched = LCD.Touch(&touchx, &touchy);
+        touched = renderer.Touch(&touchx, &touchy);
+        trace = touched && !touched_last_frame ? tracer.Touch() : -1;
 
         // Update the menu if the user clicks
         if (touched && !touched_last_frame)
         {
             if (main_menu.Update(touched, touched && !touched_last_frame, touchx, touchy))
-            {
-                endGame(&scoreboard, &world, &frog_row, frog);
+            { // Left the game
+                tracer.Report();
+                if (game_over.Running())
+                    game_over.Finish(); // Score was already saved
+                else
+                    endGame(&game);
             }
+
+            // Hand the picked difficulty to the game
+            game.SetConfig(main_menu.GetConfig());
         }
 
-        switch (state) // Switch case for the state of the game
+        if (main_menu.GetState() == 1) //* Main GAME functionality start //
         {
-
-        case 1: //* Main GAME functionality start //
-
-            //------------------------------------------
-            // Get user input
-            //------------------------------------------
-
-            if (touched && !touched_last_frame)
-            {
-                move = getUserInput(touchx, touchy, frog);
-                world.removeFromRow(frog_row, frog);
-
-                switch (move)
-                {
-
-                case 1:
-                    // Move frog up if click is above frog, update score
-                    frog_row++;
-                    scoreboard.AddRow();
-                    break;
-                case 2:
-                    // Move frog right if click is right of frog
-                    if (frog->getXpos() < SCREEN_WIDTH - TILE_WIDTH)
-                    {
-                        frog->Move(TILE_WIDTH, 0);
-                    }
-                    break;
-                case 3:
-                    // Move frog down if click is below frog, update score
-                    if (frog_row >= 3)
-                    {
-                        frog_row--;
-                        scoreboard.RemRow();
-                    }
-                    break;
-                case 4:
-                    // Move frog left if click is left of frog
-                    if (frog->getXpos() > TILE_WIDTH - 1)
-                    {
-                        frog->Move(-TILE_WIDTH, 0);
-                    }
-                    break;
-                }
-                world.addToRow(frog_row, frog);
+            if (game_over.Running())
+            { // The game stays frozen until the game over sequence is done
+                game_over.Tick(frame_time, touched, touched && !touched_last_frame);
             }
-
-            //------------------------------------------
-            // Calculations / updates
-            //------------------------------------------
-
-            // Set the scoreboard to zero if the player is at the start
-            if (frog_row <= 3)
-                scoreboard.Reset();
-
-            // Generate new rows based on the frog's position
-            world.Generate(frog_row + 12); // 12 is the number of frog rows
-
-            collided_object = world.checkCollision(frog_row, frog); // Run collision logic and return a pointer to any object the frog collides with
-
-            if (world.GetRowType(frog_row) == typeid(Water).name()) // If the frog is in a water row
+            else
             {
-                if (collided_object == NULL)
-                { // Water collision
-
-                    // Do normal drawing tasks
-                    LCD.Clear();
-                    world.Draw(frog_row - 2);
-                    scoreboard.Draw();
-
-                    endGame(&scoreboard, &world, &frog_row, frog);
-                }
-                else if (typeid(*collided_object).name() == typeid(Log).name()) // Collision with a log
-                {
-                    if (!(frog->getXpos() < 1) && !(frog->getXpos() > (SCREEN_WIDTH - frog->getWidth())))
-                    {
-                        frog->Move(collided_object->getVelocity() * frame_time, 0); // move the frog at the speed of the log
-                    }
-                }
-                else if (typeid(*collided_object).name() == typeid(Turtle).name()) // Collision with a turtle
+                // Get user input
+                move = 0;
+                if (touched && !touched_last_frame)
+                    move = getUserInput(touchx, touchy, game.frog);
+                if (move)
+                    tracer.Mark(trace, TRACE_INPUT);
+
+                // Calculations / updates
+                if (game.Step(move, frame_time))
                 {
-                    if (!(frog->getXpos() < 1) && !(frog->getXpos() > (SCREEN_WIDTH - frog->getWidth())))
-                    {
-                        frog->Move(collided_object->getVelocity() * frame_time, 0); // move the frog at the speed of the turtle
-                    }
+                    game_over.Start(&game); // The frog died
+                    tracer.Report();
                 }
+                if (move)
+                    tracer.Mark(trace, TRACE_SIMULATED);
             }
-            else if (collided_object == NULL)
-            {
-            }    // No collision
-            else // Collision with anything else
-            {
-                // Do normal drawing tasks
-                LCD.Clear();
-                world.Draw(frog_row - 2);
-                scoreboard.Draw();
-
-                endGame(&scoreboard, &world, &frog_row, frog);
-            }
-
-            world.Update(frog_row - 2, frame_time); // Update all rows on screen
-            scoreboard.RemTime(frame_time);         // Update the scoreboard based on the time on screen
-
-            //------------------------------------------
-            // Display / Draws
-            //------------------------------------------
-            // This is done seprately from the calculations to reduce screen flicker
+        } //* Main GAME functionality end //
 
-            LCD.Clear();
-            // Draw all rows on screen, starting with the frog row
-            world.Draw(frog_row - 2); //+1 is the distance of the frog from the bottom of the screen
-
-            break; //* Main GAME functionality end //
-
-        case 0:
-            // Menu is displayed elsewhere
-            LCD.Clear();
-            break;
-
-        case 2:
-            LCD.Clear();
-            // todo Display statistics
-            break;
-
-        case 3:
-            LCD.Clear();
-            // todo Display instructions
-            break;
-
-        case 4:
-            LCD.Clear();
-            // todo Display credits
-            break;
-        case 5:
-            LCD.Clear();
-            // todo Get difficulty
-        }
+        // Display / Draws
+        // This is done seprately from the calculations to reduce screen flicker
+        renderer.Publish(&main_menu, &game, &game_over, touched, touchx, touchy, trace);
+        METRICS.Publish(main_menu.GetState(), game.frog_row, &game.scoreboard, &game.world);
 
-        // Update menu (scoreboard is passsed for statistics screen display)
-        main_menu.Draw(touched, touchx, touchy, &scoreboard);
+        pacer.Wait(); // Don't run faster than the target rate
     }
 }
 
@@ -612,550 +1780,2274 @@ int main()
 // Functions / Methods
 //----------------------
 
-void Entity::Update(float dt)
-{ // Update the x value of the entity (positive velocity for rightward movement, negative for leftward)
-    xpos = fmod(SCREEN_WIDTH + xpos + dt * velocity, SCREEN_WIDTH);
+// Switch the clock an Entity moves by, keeping its current position
+void Entity::SetClock(const Seconds *new_clock)
+{
+    xpos = getXpos();
+    clock = new_clock;
+    start_time = *clock;
 }
 
-// Draw Water Row in row
-void Water::Draw(int row)
+// Remember a frame's file, to be loaded later
+void Sprite::Open(const char *file_path)
+{
+    if (num_frames == SPRITE_FRAMES)
+        return; // No room
+    paths[num_frames++] = file_path;
+}
+
+// Load the pixels of every frame's .pic file (a height and width, then one color per pixel)
+// Every frame has to be the same size
+void Sprite::Load(void)
 {
-    LCD.SetFontColor(WATER_COLOR);
-    LCD.FillRectangle(0, SCREEN_HEIGHT - (row + 1) * TILE_HEIGHT, SCREEN_WIDTH, TILE_HEIGHT);
-    for (int i = 0; i < SCREEN_WIDTH / TILE_WIDTH; i++)
+    MemoryScope scope(MEM_ASSETS);
+    for (int frame = 0; frame < num_frames; frame++)
     {
-        SPRITE_WATER.Draw(SCREEN_HEIGHT - (row + 1) * TILE_HEIGHT, i * TILE_WIDTH); // Draw water sprite
+        images[frame].Open(paths[frame]);
+
+        FEHFile *pic_in = SD.FOpen(paths[frame], "r"); // Open for reading
+        SD.FScanf(pic_in, "%d%d", &height, &width);
+        int first = pixels.size();
+        pixels.resize(first + width * height); // Add the frame onto the end of the sheet
+        for (int i = 0; i < width * height; i++)
+        {
+            int color;
+            SD.FScanf(pic_in, "%d", &color);
+            pixels[first + i] = color < 0 ? TRANSPARENT : PALETTE.Index(color); // -1 is see-through
+        }
+        SD.FClose(pic_in);
+        opaque[frame] = std::find(pixels.begin() + first, pixels.end(), TRANSPARENT) == pixels.end();
     }
-    Row::Draw(row);
+    loaded = true;
 }
 
-// Draw Road Row in row
-void Road::Draw(int row)
+void Sprite::Unload(void)
 {
-    LCD.SetFontColor(GRAY);
-    LCD.FillRectangle(0, SCREEN_HEIGHT - (row + 1) * TILE_HEIGHT, SCREEN_WIDTH, TILE_HEIGHT);
-    for (int i = 0; i < SCREEN_WIDTH / TILE_WIDTH; i++)
+    for (int frame = 0; frame < num_frames; frame++)
     {
-        SPRITE_ROAD.Draw(SCREEN_HEIGHT - (row + 1) * TILE_HEIGHT, i * TILE_WIDTH); // Draw road sprite
+        images[frame].Close();
     }
-    Row::Draw(row);
+    std::vector<unsigned char>().swap(pixels); // clear() would keep the memory
+    loaded = false;
 }
 
-// Draw Grass Row in row
-void Grass::Draw(int row)
+// Load a sprite if it isn't already, then free least recently used sprites until the cache fits again
+// Sprites used this frame are never freed, since the captured frame isn't drawn until it's presented
+void SpriteCache::Fetch(Sprite *sprite)
 {
-    LCD.SetFontColor(GREEN);
-    LCD.FillRectangle(0, SCREEN_HEIGHT - (row + 1) * TILE_HEIGHT, SCREEN_WIDTH, TILE_HEIGHT);
-    for (int i = 0; i < SCREEN_WIDTH / TILE_WIDTH; i++)
+#ifdef BOGGER_THREADS
+    std::lock_guard<std::mutex> lock(mutex);
+#endif
+    sprite->last_used = ++clock;
+    if (sprite->loaded)
+        return;
+
+    sprite->Load();
+    loads++;
+    resident.push_back(sprite);
+    used += sprite->pixels.size();
+
+    while (used > SPRITE_CACHE_PIXELS)
     {
-        SPRITE_GRASS.Draw(SCREEN_HEIGHT - (row + 1) * TILE_HEIGHT, i * TILE_WIDTH); // Draw grass sprite
+        int oldest = -1;
+        for (int i = 0; i < int(resident.size()); i++)
+        {
+            if (resident[i]->last_used <= frame_start && (oldest < 0 || resident[i]->last_used < resident[oldest]->last_used))
+                oldest = i;
+        }
+        if (oldest < 0)
+            break; // Everything loaded is used this frame, go over for now
+        used -= resident[oldest]->pixels.size();
+        resident[oldest]->Unload();
+        resident.erase(resident.begin() + oldest);
+        evictions++;
     }
-    Row::Draw(row);
-    Row::Draw(row);
 }
 
-// Draw Car Entity in row
-void Car::Draw(int row)
+void SpriteCache::NewFrame(void)
 {
-    SPRITE_CAR.Draw(SCREEN_HEIGHT - (row + 1) * TILE_HEIGHT + 1, xpos);
+#ifdef BOGGER_THREADS
+    std::lock_guard<std::mutex> lock(mutex);
+#endif
+    frame_start = clock;
 }
 
-// Draw Log Entity in row
-void Log::Draw(int row)
+// Find a color in the palette, or add it. Once the palette is full the closest color is used instead
+unsigned char Palette::Index(unsigned int color)
 {
-    LCD.SetFontColor(LOG_COLOR);
-    LCD.FillRectangle(xpos + 1, SCREEN_HEIGHT - (row + 1) * TILE_HEIGHT + 1, width - 1, height); // Still draw the rectangle as a fallback for weird sprite behavior
-    for (int i = 0; i < int(width / TILE_WIDTH); i++)
+#ifdef BOGGER_THREADS
+    std::lock_guard<std::mutex> lock(mutex);
+#endif
+    if (count > 0 && colors[last] == color)
+        return last;
+
+    int best = 0, best_distance = 1 << 30;
+    for (int i = 0; i < count; i++)
     {
-        SPRITE_LOG.Draw(SCREEN_HEIGHT - (row + 1) * TILE_HEIGHT, xpos + i * TILE_WIDTH); // Draw log sprite
+        if (colors[i] == color)
+        {
+            last = i;
+            return i;
+        }
+        int dr = int(colors[i] >> 16 & 0xff) - int(color >> 16 & 0xff);
+        int dg = int(colors[i] >> 8 & 0xff) - int(color >> 8 & 0xff);
+        int db = int(colors[i] & 0xff) - int(color & 0xff);
+        if (dr * dr + dg * dg + db * db < best_distance)
+        {
+            best = i;
+            best_distance = dr * dr + dg * dg + db * db;
+        }
     }
+
+    if (count == PALETTE_SIZE)
+        return best; // Full
+    colors[count] = color;
+    last = count;
+    return count++;
 }
 
-// Draw Frog Entity in row
-void Frog::Draw(int row)
+// Draw a frame of the sprite with its top left corner at (left, top)
+void Sprite::Draw(int top, int left, int frame)
 {
-    SPRITE_FROG.Draw(SCREEN_HEIGHT - (row + 1) * TILE_HEIGHT + 1, xpos + 1);
+    SPRITES.Fetch(this);
+    SCREEN.DrawSprite(this, top, left, frame);
 }
 
-// Draw Turtle Entity in row
-void Turtle::Draw(int row)
+void Canvas::SetFontColor(unsigned int new_color)
 {
-    SPRITE_TURTLE.Draw(SCREEN_HEIGHT - (row + 1) * TILE_HEIGHT, xpos);
+    color = new_color;
+    if (capture)
+        color_index = PALETTE.Index(new_color);
 }
 
-// Draw World, given start row
-void World::Draw(int start_row)
+void Canvas::FillRectangle(int x, int y, int w, int h)
 {
-    if ((start_row < int(world_elements.size())) && start_row >= 0) // Ensure there's no out-of-index refrencing
-    {
-        int i = 0;
-        for (std::vector<Row *>::iterator it = world_elements.begin() + start_row; it != world_elements.end(); it++)
-        { // Starting at the given index, draw rows bottom up //todo Add limit based on screen height in tiles
-            (*it)->Draw(i);
-            if (i++ > 10)
-                break; // Iterate and also only render elements on the screen
-        }
-    }
-    else
-    {                               // If something tries to draw an invalid array index, display a pink background instead as an error
-        LCD.SetFontColor(0xff00ff); // ERROR COLORING
-        LCD.FillRectangle(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
-    }
+    Record(DRAW_FILL, x, y, w, h);
 }
 
-// Update world, and all position
-void World::Update(int start_row, float dt)
-{                                                                   // Basically the same as the draw function but it updates things instead :)
-    if ((start_row < int(world_elements.size())) && start_row >= 0) // Ensure there's no out-of-index refrencing
-    {
-        int i = 0;
-        for (std::vector<Row *>::iterator it = world_elements.begin() + start_row; it != world_elements.end(); it++)
-        { // Starting at the given index, draw rows bottom up
-            (*it)->Update(dt);
-            if (i++ > 10)
-                break; // Iterate and also only calculate elements on the screen
-        }
-    }
-    else
-    {                               // If something tries to update an invalid array index, display a pink background instead as an error
-        LCD.SetFontColor(0xff00ff); // ERROR COLORING
-        LCD.FillRectangle(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
-    }
+void Canvas::DrawRectangle(int x, int y, int w, int h)
+{
+    Record(DRAW_OUTLINE, x, y, w, h);
 }
 
-// Add entity to to row
-void World::addToRow(int currentRow, Entity *add)
+void Canvas::WriteAt(const char *new_text, int x, int y)
 {
-    world_elements.at(currentRow)->AddElement(add);
+    if (!lcd_on)
+        return; // Captured frames leave text out
+    int start = text.size();
+    text.insert(text.end(), new_text, new_text + strlen(new_text) + 1); // Callers can reuse their string right away
+    Record(DRAW_TEXT, x, y, strlen(new_text) * CHAR_WIDTH, CHAR_HEIGHT, NULL, 0, start);
 }
 
-// Create a row of a random type of Row at the top of the screen based on the frog position
-void World::Generate(int new_rows_total)
+void Canvas::Clear(void)
 {
-    int new_num_rows;
-    while (int(world_elements.size()) < new_rows_total)
-    { // Add rows until theres enough
+    unsigned char old_color = color_index;
+    if (capture)
+        color_index = PALETTE.Index(BLACK);
+    Record(DRAW_CLEAR, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+    color_index = old_color;
+}
 
-        if ((Random.RandInt() % 2))
-        {                                            // 0.5 chance of road
-            new_num_rows = Random.RandInt() % 4 + 2; // Add between 2 and 5 road tiles
-            for (int i = 0; i < new_num_rows; i++)
-            {
-                World::AddRow(new Road(0));
-            }
-        }
-        else
-        {                                            // 0.5 chance of road
-            new_num_rows = Random.RandInt() % 4 + 2; // Add between 2 and 5 water tiles
-            for (int i = 0; i < new_num_rows; i++)
-            {
-                World::AddRow(new Water(0));
-            }
-        }
+void Canvas::DrawSprite(Sprite *sprite, int top, int left, int sprite_frame)
+{
+    Record(DRAW_SPRITE, left, top, sprite->width, sprite->height, sprite, sprite_frame);
+}
 
-        World::AddRow(new Grass()); // Terminate with a grass row every time
+void Canvas::Record(unsigned char kind, int x, int y, int w, int h, Sprite *sprite, int sprite_frame, int text_start)
+{
+    if (lcd_on || capture)
+        commands.push_back({kind, false, x, y, w, h, color, color_index, sprite, sprite_frame, text_start});
+}
+
+bool Canvas::Clip(const DrawCommand &c, int *x, int *y, int *x_end, int *y_end)
+{
+    *x = std::max(c.x, 0);
+    *y = std::max(c.y, 0);
+    *x_end = std::min(c.x + c.w, SCREEN_WIDTH);
+    *y_end = std::min(c.y + c.h, SCREEN_HEIGHT);
+    return *x < *x_end && *y < *y_end;
+}
+
+// Both go through a row 32 pixels at a time, masking off the ends
+bool Canvas::Covered(int x, int y, int x_end, int y_end)
+{
+    for (int j = y; j < y_end; j++)
+    {
+        for (int i = x, n; i < x_end; i += n)
+        {
+            n = std::min(32 - i % 32, x_end - i);
+            unsigned int mask = (n == 32 ? ~0u : (1u << n) - 1) << (i % 32);
+            if ((covered[j][i / 32] & mask) != mask)
+                return false;
+        }
     }
+    return true;
 }
 
-// Remove Entity from Row
-void World::removeFromRow(int currentRow, Entity *add)
+void Canvas::Cover(int x, int y, int x_end, int y_end)
 {
-    world_elements.at(currentRow)->RemElement(add);
+    for (int j = y; j < y_end; j++)
+    {
+        for (int i = x, n; i < x_end; i += n)
+        {
+            n = std::min(32 - i % 32, x_end - i);
+            covered[j][i / 32] |= (n == 32 ? ~0u : (1u << n) - 1) << (i % 32);
+        }
+    }
 }
 
-// Check collision between frog and any other entity. Returns the pointer to the entity it collides with.
-Entity *World::checkCollision(int currentRow, Entity *check)
+// Going backwards, anything fully under what's already been seen is hidden. Then going forwards, repeats are
+// dropped and fills are merged into the one before when together they make a rectangle
+void Canvas::Cull(void)
 {
+    int x, y, x_end, y_end;
+    memset(covered, 0, sizeof(covered));
+    for (int i = int(commands.size()) - 1; i >= 0; i--)
+    {
+        DrawCommand &c = commands[i];
+        if (c.kind == DRAW_TEXT)
+            continue; // Never hidden, and never hides anything
+        if (!Clip(c, &x, &y, &x_end, &y_end) || (c.kind != DRAW_OUTLINE && Covered(x, y, x_end, y_end)))
+        {
+            c.culled = true;
+            continue;
+        }
+        if (c.kind == DRAW_FILL || c.kind == DRAW_CLEAR || (c.kind == DRAW_SPRITE && c.sprite->opaque[c.sprite_frame]))
+            Cover(x, y, x_end, y_end);
+    }
 
-    for (Entity *e : world_elements.at(currentRow)->getEntities()) // For every entity in the row
+    DrawCommand *last = NULL; // Last command kept
+    for (DrawCommand &c : commands)
     {
-        if (!(e == check)) // besides the check element
+        if (c.culled)
+            continue;
+        if (last && last->kind == c.kind && last->x == c.x && last->y == c.y && last->w == c.w && last->h == c.h &&
+            last->color == c.color && last->sprite == c.sprite && last->sprite_frame == c.sprite_frame &&
+            (c.kind != DRAW_TEXT || !strcmp(&text[last->text], &text[c.text])))
+        { // Exactly the same as the last one
+            c.culled = true;
+            continue;
+        }
+        if (last && c.kind == DRAW_FILL && last->kind == DRAW_FILL && last->color == c.color)
         {
-            if (typeid(*e).name() == typeid(Log).name() || (typeid(*e).name() == typeid(Turtle).name()))
-            {
-                if (e->getXpos() - check->getXpos() < check->getWidth() && e->getXpos() - check->getXpos() > 0) // If it overlaps
-                {
-                    return e;
-                }
+            if (last->y == c.y && last->h == c.h && (last->x + last->w == c.x || c.x + c.w == last->x))
+            { // Side by side
+                last->x = std::min(last->x, c.x);
+                last->w += c.w;
+                c.culled = true;
+                continue;
+            }
+            if (last->x == c.x && last->w == c.w && (last->y + last->h == c.y || c.y + c.h == last->y))
+            { // One on top of the other
+                last->y = std::min(last->y, c.y);
+                last->h += c.h;
+                c.culled = true;
+                continue;
+            }
+        }
+        last = &c;
+    }
+}
 
-                if (e->getVelocity() < 0 || e->getVelocity() > 0)
+// Sprites and clears stay where they are. Between them, fills, outlines and text are gathered into runs where nothing
+// overlaps, so the order within a run doesn't matter and each run can be sorted by color
+void Canvas::SendToLCD(void)
+{
+    order.clear();
+    run.clear();
+    for (int i = 0; i <= int(commands.size()); i++)
+    {
+        bool end_run = i == int(commands.size());
+        if (!end_run && commands[i].culled)
+            continue;
+        if (!end_run && commands[i].kind != DRAW_SPRITE && commands[i].kind != DRAW_CLEAR)
+        {
+            const DrawCommand &c = commands[i];
+            for (int j : run)
+            {
+                const DrawCommand &other = commands[j];
+                if (c.x < other.x + other.w && other.x < c.x + c.w && c.y < other.y + other.h && other.y < c.y + c.h)
                 {
-                    if (check->getXpos() - (e->getXpos() - SCREEN_WIDTH) < e->getWidth() && check->getXpos() - (e->getXpos() - SCREEN_WIDTH) > 0) // If it overlaps
-                    {
-                        return e;
-                    }
+                    end_run = true; // Overlaps, so it has to stay after everything already in the run
+                    break;
                 }
             }
+            if (!end_run)
+            {
+                run.push_back(i);
+                continue;
+            }
+        }
+        std::stable_sort(run.begin(), run.end(), [this](int a, int b)
+                         { return commands[a].color < commands[b].color; });
+        order.insert(order.end(), run.begin(), run.end());
+        run.clear();
+        if (i == int(commands.size()))
+            break;
+        if (commands[i].kind == DRAW_SPRITE || commands[i].kind == DRAW_CLEAR)
+            order.push_back(i);
+        else
+            run.push_back(i); // Starts the next run
+    }
 
-            if (e->getXpos() - check->getXpos() < check->getWidth() && e->getXpos() - check->getXpos() > 0) // If it overlaps
+    bool color_set = false;
+    unsigned int lcd_color = 0;
+    for (int i : order)
+    {
+        const DrawCommand &c = commands[i];
+        if (c.kind != DRAW_SPRITE && c.kind != DRAW_CLEAR && (!color_set || lcd_color != c.color))
+        { // Only change color when it's actually different
+            LCD.SetFontColor(c.color);
+            lcd_color = c.color;
+            color_set = true;
+        }
+        switch (c.kind)
+        {
+        case DRAW_FILL:
+            LCD.FillRectangle(c.x, c.y, c.w, c.h);
+            break;
+        case DRAW_OUTLINE:
+            LCD.DrawRectangle(c.x, c.y, c.w, c.h);
+            break;
+        case DRAW_TEXT:
+            LCD.WriteAt(&text[c.text], c.x, c.y);
+            break;
+        case DRAW_SPRITE:
+            c.sprite->images[c.sprite_frame].Draw(c.y, c.x);
+            color_set = false; // FEHIMAGE sets the font color for every pixel it draws
+            break;
+        case DRAW_CLEAR:
+            LCD.Clear();
+            color_set = false; // Clearing goes through the font color too
+            break;
+        }
+    }
+    if (!order.empty() && (!color_set || lcd_color != color))
+        LCD.SetFontColor(color); // Leave the LCD on the color the game last picked
+}
+
+// Draw the commands that touch one band, clipped to it. Screen pixels become CAPTURE_SCALE x CAPTURE_SCALE blocks
+void Canvas::DrawBand(int band)
+{
+    int band_top = band * TILE_HEIGHT, band_bottom = band_top + TILE_HEIGHT; // Screen rows
+
+    for (int i : band_commands[band])
+    {
+        const DrawCommand &c = commands[i];
+        int x = std::max(c.x, 0), x_end = std::min(c.x + c.w, SCREEN_WIDTH);
+        int y = std::max(c.y, band_top), y_end = std::min(c.y + c.h, band_bottom);
+        if (x >= x_end)
+            continue;
+
+        for (int sy = y * CAPTURE_SCALE; sy < y_end * CAPTURE_SCALE; sy++)
+        {
+            unsigned char *dest = &frame[sy * CAPTURE_WIDTH];
+            if (c.kind == DRAW_OUTLINE && sy / CAPTURE_SCALE != c.y && sy / CAPTURE_SCALE != c.y + c.h - 1)
+            { // Between the top and bottom edges, only the sides
+                if (c.x >= 0)
+                    std::fill(&dest[c.x * CAPTURE_SCALE], &dest[(c.x + 1) * CAPTURE_SCALE], c.color_index);
+                if (c.x + c.w <= SCREEN_WIDTH)
+                    std::fill(&dest[(c.x + c.w - 1) * CAPTURE_SCALE], &dest[(c.x + c.w) * CAPTURE_SCALE], c.color_index);
+                continue;
+            }
+            if (c.kind != DRAW_SPRITE)
             {
-                return e;
+                std::fill(&dest[x * CAPTURE_SCALE], &dest[x_end * CAPTURE_SCALE], c.color_index);
+                continue;
+            }
+            // The sprite's row, indexed from the sprite's own left edge so the pointer never points outside it
+            const unsigned char *src = &c.sprite->pixels[(c.sprite_frame * c.sprite->height + sy / CAPTURE_SCALE - c.y) * c.sprite->width];
+            for (int sx = x * CAPTURE_SCALE; sx < x_end * CAPTURE_SCALE; sx++)
+            {
+                unsigned char pixel = src[sx / CAPTURE_SCALE - c.x];
+                if (pixel != TRANSPARENT)
+                    dest[sx] = pixel;
             }
+        }
+    }
+}
 
-            if (check->getXpos() - e->getXpos() < e->getWidth() && check->getXpos() - e->getXpos() > 0) // If it overlaps
+// Clean up the frame's commands, send them to the LCD, and draw the captured frame a band at a time
+void Canvas::Present(void)
+{
+    Cull();
+    if (lcd_on)
+        SendToLCD();
+
+    if (capture && !commands.empty() && (frame = capture->Acquire()))
+    { // Sort the commands into the bands they touch, keeping their order
+        for (int i = 0; i < int(commands.size()); i++)
+        {
+            if (commands[i].culled || commands[i].kind == DRAW_TEXT)
+                continue;
+            int first = std::max(commands[i].y, 0) / TILE_HEIGHT;
+            int last = std::min(commands[i].y + commands[i].h - 1, SCREEN_HEIGHT - 1) / TILE_HEIGHT;
+            for (int band = first; band <= last; band++)
             {
-                return e;
+                band_commands[band].push_back(i);
             }
         }
+
+        parallelFor(RENDER_BANDS, [this](int first, int last)
+                    {
+                        for (int band = first; band < last; band++)
+                        {
+                            DrawBand(band);
+                        } });
+        capture->Submit(frame);
+
+        for (std::vector<int> &band : band_commands)
+        {
+            band.clear();
+        }
     }
-    return NULL;
+    frame = NULL;
+    commands.clear();
+    text.clear();
+    SPRITES.NewFrame(); // Nothing is waiting on this frame's sprites anymore
 }
 
-// Returns a vector of Entity*
-std::vector<Entity *> Row::getEntities()
+FrameCapture::FrameCapture(int new_mode)
 {
-    return row_elements;
+    mode = new_mode;
+    for (int i = 0; i < CAPTURE_BUFFERS; i++)
+    {
+        buffers[i].resize(CAPTURE_WIDTH * CAPTURE_HEIGHT, PALETTE.Index(BLACK)); // Parts of the screen aren't drawn every frame
+        free_buffers.push_back(buffers[i].data());
+    }
+    if (mode == 2)
+        stream = fopen(CAPTURE_PATH ".rgb", "wb");
+#ifdef BOGGER_THREADS
+    encoder = std::thread(&FrameCapture::Work, this);
+#endif
 }
 
-// Return X position of an Entity
-float Entity::getXpos()
+FrameCapture::~FrameCapture()
 {
-    return xpos;
+#ifdef BOGGER_THREADS
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        quit = true;
+    }
+    wake.notify_one();
+    encoder.join();
+#endif
+    if (stream)
+        fclose(stream);
 }
 
-// Return Y position of an Entity
-float Entity::getYpos()
+unsigned char *FrameCapture::Acquire(void)
 {
-    return ypos;
+#ifdef BOGGER_THREADS
+    std::unique_lock<std::mutex> lock(mutex);
+#endif
+    if (free_buffers.empty())
+    { // The encoder is behind, drop this frame rather than slowing down the game
+        frames_skipped++;
+        return NULL;
+    }
+    unsigned char *frame = free_buffers.back();
+    free_buffers.pop_back();
+    return frame;
+}
+
+void FrameCapture::Submit(unsigned char *frame)
+{
+#ifdef BOGGER_THREADS
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        queued_buffers.push_back(frame);
+    }
+    wake.notify_one();
+#else
+    Encode(frame); // No encoder thread, so write it right away
+    free_buffers.push_back(frame);
+#endif
+}
+
+#ifdef BOGGER_THREADS
+// Encode queued frames in order until told to quit and nothing is left
+void FrameCapture::Work(void)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (1)
+    {
+        wake.wait(lock, [this]
+                  { return quit || !queued_buffers.empty(); });
+        if (queued_buffers.empty())
+            return; // Quitting with nothing left to write
+
+        unsigned char *frame = queued_buffers.front();
+        queued_buffers.erase(queued_buffers.begin());
+        lock.unlock();
+        Encode(frame);
+        lock.lock();
+        free_buffers.push_back(frame);
+    }
+}
+#endif
+
+// Write one frame as RGB bytes, either to its own PPM file or onto the end of the raw stream
+void FrameCapture::Encode(unsigned char *frame)
+{
+    FILE *out = stream;
+    if (mode == 1)
+    {
+        char file_path[32];
+        sprintf(file_path, CAPTURE_PATH "%05d.ppm", frames_written);
+        out = fopen(file_path, "wb");
+        if (out)
+            fprintf(out, "P6\n%d %d\n255\n", CAPTURE_WIDTH, CAPTURE_HEIGHT);
+    }
+    if (!out)
+        return;
+
+    for (int y = 0; y < CAPTURE_HEIGHT; y++)
+    {
+        for (int x = 0; x < CAPTURE_WIDTH; x++)
+        {
+            unsigned int pixel = PALETTE.colors[frame[y * CAPTURE_WIDTH + x]]; // Palette index to full color
+            row_bytes[3 * x] = pixel >> 16;
+            row_bytes[3 * x + 1] = pixel >> 8;
+            row_bytes[3 * x + 2] = pixel;
+        }
+        fwrite(row_bytes, 1, sizeof(row_bytes), out);
+    }
+    frames_written++;
+
+    if (mode == 1)
+        fclose(out);
+}
+
+// Draw Water Row in row
+void Water::Draw(int row)
+{
+    DrawBackground(row, Time());
+    Row::Draw(row);
+}
+
+// Draw the water itself in row, rippling at time
+void Water::DrawBackground(int row, Seconds time)
+{
+    int ripple = SPRITE_WATER.FrameAt(time, WATER_FPS);
+    SCREEN.SetFontColor(WATER_COLOR);
+    SCREEN.FillRectangle(0, SCREEN_HEIGHT - (row + 1) * TILE_HEIGHT, SCREEN_WIDTH, TILE_HEIGHT);
+    for (int i = 0; QUALITY.Level() == QUALITY_FULL && i < SCREEN_WIDTH / TILE_WIDTH; i++)
+    {
+        SPRITE_WATER.Draw(SCREEN_HEIGHT - (row + 1) * TILE_HEIGHT, i * TILE_WIDTH, ripple); // Draw water sprite
+    }
+}
+
+// Draw Road Row in row
+void Road::Draw(int row)
+{
+    DrawBackground(row);
+    Row::Draw(row);
+}
+
+// Draw the road itself in row
+void Road::DrawBackground(int row)
+{
+    SCREEN.SetFontColor(GRAY);
+    SCREEN.FillRectangle(0, SCREEN_HEIGHT - (row + 1) * TILE_HEIGHT, SCREEN_WIDTH, TILE_HEIGHT);
+    for (int i = 0; QUALITY.Level() == QUALITY_FULL && i < SCREEN_WIDTH / TILE_WIDTH; i++)
+    {
+        SPRITE_ROAD.Draw(SCREEN_HEIGHT - (row + 1) * TILE_HEIGHT, i * TILE_WIDTH); // Draw road sprite
+    }
+}
+
+// Draw Grass Row in row
+void Grass::Draw(int row)
+{
+    DrawBackground(row);
+    Row::Draw(row);
+    if (QUALITY.Level() == QUALITY_FULL)
+        Row::Draw(row);
+}
+
+// Draw the grass itself in row
+void Grass::DrawBackground(int row)
+{
+    SCREEN.SetFontColor(GREEN);
+    SCREEN.FillRectangle(0, SCREEN_HEIGHT - (row + 1) * TILE_HEIGHT, SCREEN_WIDTH, TILE_HEIGHT);
+    for (int i = 0; QUALITY.Level() == QUALITY_FULL && i < SCREEN_WIDTH / TILE_WIDTH; i++)
+    {
+        SPRITE_GRASS.Draw(SCREEN_HEIGHT - (row + 1) * TILE_HEIGHT, i * TILE_WIDTH); // Draw grass sprite
+    }
+}
+
+// Draw Car Entity in row
+void Car::Draw(int row)
+{
+    DrawAt(row, getXpos());
+}
+
+// Draw a car at x in row
+void Car::DrawAt(int row, Scalar x)
+{
+    SPRITE_CAR.Draw(SCREEN_HEIGHT - (row + 1) * TILE_HEIGHT + 1, int(x));
+}
+
+// Draw Log Entity in row
+void Log::Draw(int row)
+{
+    DrawAt(row, getXpos(), width, height);
+}
+
+// Draw a log at xpos in row
+void Log::DrawAt(int row, Scalar xpos, Scalar width, Scalar height)
+{
+    if (QUALITY.Level() < QUALITY_LOW)
+    {
+        SCREEN.SetFontColor(LOG_COLOR);
+        SCREEN.FillRectangle(int(xpos + 1), SCREEN_HEIGHT - (row + 1) * TILE_HEIGHT + 1, int(width - 1), int(height)); // Still draw the rectangle as a fallback for weird sprite behavior
+    }
+    for (int i = 0; i < int(width / TILE_WIDTH); i++)
+    {
+        SPRITE_LOG.Draw(SCREEN_HEIGHT - (row + 1) * TILE_HEIGHT, int(xpos + i * TILE_WIDTH)); // Draw log sprite
+    }
+}
+
+// Draw Frog Entity in row
+void Frog::Draw(int row)
+{
+    DrawAt(row, getXpos(), Time() - hop_time);
+}
+
+// Draw the frog at x in row, since_hop seconds after it last hopped
+void Frog::DrawAt(int row, Scalar x, Seconds since_hop)
+{
+    int frame = since_hop < FROG_HOP_TIME ? 1 % SPRITE_FROG.num_frames : 0; // Legs out for a moment after a hop
+    SPRITE_FROG.Draw(SCREEN_HEIGHT - (row + 1) * TILE_HEIGHT + 1, int(x + 1), frame);
+}
+
+// Draw Turtle Entity in row
+void Turtle::Draw(int row)
+{
+    DrawAt(row, getXpos(), Time());
+}
+
+// Draw a turtle at x in row, paddling along with time
+void Turtle::DrawAt(int row, Scalar x, Seconds time)
+{
+    SPRITE_TURTLE.Draw(SCREEN_HEIGHT - (row + 1) * TILE_HEIGHT, int(x), SPRITE_TURTLE.FrameAt(time, TURTLE_FPS));
+}
+
+// Draw World, given start row
+void World::Draw(int start_row)
+{
+    if ((start_row < int(world_elements.size())) && start_row >= 0) // Ensure there's no out-of-index refrencing
+    {
+        int i = 0;
+        for (std::vector<Row *>::iterator it = world_elements.begin() + start_row; it != world_elements.end(); it++)
+        { // Starting at the given index, draw rows bottom up //todo Add limit based on screen height in tiles
+            (*it)->Draw(i);
+            if (++i >= ROWS_ON_SCREEN)
+                break; // Iterate and also only render elements on the screen
+        }
+    }
+    else
+    {                               // If something tries to draw an invalid array index, display a pink background instead as an error
+        SCREEN.SetFontColor(0xff00ff); // ERROR COLORING
+        SCREEN.FillRectangle(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+    }
+}
+
+// Update world. Obstacles move at a constant speed, so only the clock needs to move and positions are worked out when asked for
+void World::Update(Scalar dt)
+{
+    time += dt;
+}
+
+// Add entity to to row
+void World::addToRow(int currentRow, Entity *add)
+{
+    world_elements.at(currentRow)->AddElement(add);
+}
+
+// Create a row of a random type of Row at the top of the screen based on the frog position
+void World::Generate(int new_rows_total)
+{
+    int new_num_rows;
+    if (int(world_elements.size()) >= new_rows_total)
+        return; // Already enough rows
+
+#ifdef BOGGER_THREADS
+    // Random isn't thread safe, and generating is rare enough for hosted sessions to just take turns
+    static std::mutex generate_lock;
+    std::lock_guard<std::mutex> lock(generate_lock);
+#endif
+    while (int(world_elements.size()) < new_rows_total)
+    { // Add rows until theres enough
+
+        if (Random.RandInt() % 100 < config.road_chance)
+        {                                            // road_chance% chance of road
+            new_num_rows = Random.RandInt() % 4 + 2; // Add between 2 and 5 road tiles
+            for (int i = 0; i < new_num_rows; i++)
+            {
+                World::AddRow(new Road(0, config.difficulty));
+            }
+            SPRITES.Fetch(&SPRITE_ROAD); // Load what the new rows need before they scroll on screen
+            SPRITES.Fetch(&SPRITE_CAR);
+        }
+        else
+        {                                            // Otherwise water
+            new_num_rows = Random.RandInt() % 4 + 2; // Add between 2 and 5 water tiles
+            for (int i = 0; i < new_num_rows; i++)
+            {
+                World::AddRow(new Water(0, config.difficulty));
+            }
+            SPRITES.Fetch(&SPRITE_WATER);
+            SPRITES.Fetch(&SPRITE_LOG);
+            SPRITES.Fetch(&SPRITE_TURTLE);
+        }
+
+        World::AddRow(new Grass()); // Terminate with a grass row every time
+        SPRITES.Fetch(&SPRITE_GRASS);
+    }
+}
+
+// Copy the rows from the top of the world down into the snapshot, as many as fit. Only plain values are stored so it
+// can be copied freely. Returns false if rows the frog can see or reach, or obstacles, had to be left out
+bool World::Save(GameSnapshot *snap, Entity *skip)
+{
+    // Generating keeps at most ROWS_AHEAD + MOST_ROWS_GENERATED - 1 rows from the frog's up, and two more are on screen below it
+    static_assert(SNAPSHOT_ROWS >= ROWS_AHEAD + MOST_ROWS_GENERATED + 1, "snapshots have to hold every row the frog can see or reach");
+    bool whole = true;
+    snap->first_row = std::max(0, int(world_elements.size()) - SNAPSHOT_ROWS);
+    if (snap->first_row > snap->frog_row - 2)
+    { // The frog went back down further than a snapshot reaches. Keep what's on screen and leave out the top
+        snap->first_row = std::max(0, snap->frog_row - 2);
+        whole = false;
+    }
+    snap->num_rows = std::min(SNAPSHOT_ROWS, int(world_elements.size()) - snap->first_row);
+
+    for (int i = 0; i < snap->num_rows; i++)
+    {
+        Row *row = world_elements[snap->first_row + i];
+        RowState *row_state = &snap->rows[i];
+
+        if (typeid(*row).name() == typeid(Road).name())
+            row_state->kind = KIND_ROAD;
+        else if (typeid(*row).name() == typeid(Water).name())
+            row_state->kind = KIND_WATER;
+        else
+            row_state->kind = KIND_GRASS;
+        row_state->variant = row->GetVariant();
+
+        row_state->num_entities = 0;
+        for (Entity *e : row->getEntities())
+        {
+            if (e == skip)
+                continue; // The frog is saved on its own
+            if (row_state->num_entities >= SNAPSHOT_ENTITIES)
+            {
+                whole = false; // No room
+                continue;
+            }
+
+            EntityState *entity_state = &row_state->entities[row_state->num_entities++];
+            if (typeid(*e).name() == typeid(Log).name())
+                entity_state->kind = KIND_LOG;
+            else if (typeid(*e).name() == typeid(Turtle).name())
+                entity_state->kind = KIND_TURTLE;
+            else
+                entity_state->kind = KIND_CAR;
+            entity_state->xpos = e->getXpos();
+            entity_state->velocity = e->getVelocity();
+            entity_state->width = int(e->getWidth());
+        }
+    }
+    return whole;
+}
+
+// Throw away the current rows and rebuild them from a snapshot
+void World::Load(const GameSnapshot *snap)
+{
+    for (Row *e : world_elements)
+    { // Delete every old row (the frog must already be removed)
+        delete e;
+    }
+    world_elements.clear();
+    time = snap->time; // Before adding anything, so every obstacle keeps its saved position
+
+    for (int i = 0; i < snap->first_row; i++)
+    { // Rows too far below the frog to matter come back as grass
+        AddRow(new Grass());
+    }
+
+    for (int i = 0; i < snap->num_rows; i++)
+    {
+        const RowState *row_state = &snap->rows[i];
+        Row *row;
+        if (row_state->kind == KIND_ROAD)
+            row = new Road();
+        else if (row_state->kind == KIND_WATER)
+            row = new Water();
+        else
+            row = new Grass();
+        row->SetVariant(row_state->variant);
+
+        for (int j = 0; j < row_state->num_entities; j++)
+        {
+            const EntityState *entity_state = &row_state->entities[j];
+            Entity *e;
+            if (entity_state->kind == KIND_LOG)
+                e = new Log(0, 0, entity_state->width);
+            else if (entity_state->kind == KIND_TURTLE)
+                e = new Turtle(0, 0, entity_state->width);
+            else
+                e = new Car(0, 0, 0, entity_state->width);
+            e->Set(entity_state->xpos, entity_state->velocity);
+            row->AddElement(e);
+        }
+        AddRow(row);
+    }
+}
+
+// Fill in a grid of what's in each tile, OBS_COLS tiles per row, for num_rows rows starting at start_row
+// Grids of PARALLEL_MIN_ROWS or more are split into blocks of OBS_BLOCK_ROWS across the worker threads. Blocks are
+// whole cache lines, so as long as cells starts on one no two threads ever write to the same line
+void World::Observe(int start_row, int num_rows, unsigned char *cells)
+{
+    static_assert(OBS_BLOCK_ROWS * OBS_COLS % CACHE_LINE == 0, "blocks have to be whole cache lines");
+    if (num_rows < PARALLEL_MIN_ROWS)
+    { // Not worth waking the workers
+        ObserveRows(start_row, 0, num_rows, cells);
+        return;
+    }
+    int blocks = (num_rows + OBS_BLOCK_ROWS - 1) / OBS_BLOCK_ROWS;
+    parallelFor(blocks, [&](int first, int last)
+                { ObserveRows(start_row, first * OBS_BLOCK_ROWS, std::min(last * OBS_BLOCK_ROWS, num_rows), cells); });
+}
+
+// Only reads the world, so any number of threads can run this on different rows
+void World::ObserveRows(int start_row, int first, int last, unsigned char *cells)
+{
+    for (int i = first; i < last; i++)
+    {
+        unsigned char *row_cells = &cells[i * OBS_COLS];
+        int row = start_row + i;
+        if (row < 0 || row >= int(world_elements.size()))
+        { // Past the ends of the world
+            std::fill(row_cells, row_cells + OBS_COLS, CELL_GROUND);
+            continue;
+        }
+
+        bool water = typeid(*world_elements[row]).name() == typeid(Water).name();
+        std::fill(row_cells, row_cells + OBS_COLS, water ? CELL_WATER : CELL_GROUND);
+
+        for (Entity *e : world_elements[row]->getEntities())
+        {
+            unsigned char cell = CELL_CAR;
+            if (typeid(*e).name() == typeid(Frog).name())
+                cell = CELL_FROG;
+            else if (typeid(*e).name() == typeid(Log).name() || typeid(*e).name() == typeid(Turtle).name())
+                cell = CELL_FLOAT;
+
+            int first = int(e->getXpos()) / TILE_WIDTH;
+            int tiles = std::max(1, int(e->getWidth()) / TILE_WIDTH);
+            for (int j = 0; j < tiles; j++)
+            { // Obstacles wrap around the screen
+                row_cells[(first + j) % OBS_COLS] = cell;
+            }
+        }
+    }
+}
+
+// Remove Entity from Row
+void World::removeFromRow(int currentRow, Entity *add)
+{
+    world_elements.at(currentRow)->RemElement(add);
+}
+
+// Check collision between frog and any other entity. Returns the pointer to the entity it collides with.
+Entity *World::checkCollision(int currentRow, Entity *check)
+{
+
+    for (Entity *e : world_elements.at(currentRow)->getEntities()) // For every entity in the row
+    {
+        if (!(e == check)) // besides the check element
+        {
+            if (typeid(*e).name() == typeid(Log).name() || (typeid(*e).name() == typeid(Turtle).name()))
+            {
+                if (e->getXpos() - check->getXpos() < check->getWidth() && e->getXpos() - check->getXpos() > 0) // If it overlaps
+                {
+                    return e;
+                }
+
+                if (e->getVelocity() < 0 || e->getVelocity() > 0)
+                {
+                    if (check->getXpos() - (e->getXpos() - SCREEN_WIDTH) < e->getWidth() && check->getXpos() - (e->getXpos() - SCREEN_WIDTH) > 0) // If it overlaps
+                    {
+                        return e;
+                    }
+                }
+            }
+
+            if (e->getXpos() - check->getXpos() < check->getWidth() && e->getXpos() - check->getXpos() > 0) // If it overlaps
+            {
+                return e;
+            }
+
+            if (check->getXpos() - e->getXpos() < e->getWidth() && check->getXpos() - e->getXpos() > 0) // If it overlaps
+            {
+                return e;
+            }
+        }
+    }
+    return NULL;
+}
+
+// Returns the row's vector of Entity*
+const std::vector<Entity *> &Row::getEntities()
+{
+    return row_elements;
+}
+
+// Return X position of an Entity, wrapped around the screen (positive velocity for rightward movement, negative for leftward)
+// Things that don't move aren't wrapped. The frog has a clock for its hop animation, but rides logs by moving xpos, and
+// the edge checks in Game::Step need to see it go past the edge rather than come back in on the other side
+Scalar Entity::getXpos()
+{
+    if (!clock || velocity == 0)
+        return xpos;
+    return trackPosition(xpos, velocity, *clock - start_time);
+}
+
+// Return Y position of an Entity
+Scalar Entity::getYpos()
+{
+    return ypos;
+}
+
+// Return Width of an Entity
+Scalar Entity::getWidth()
+{
+    return width;
+}
+
+// Return Velocity of an Entity
+Scalar Entity::getVelocity()
+{
+    return velocity;
+}
+
+// Set the position and velocity of an Entity directly
+void Entity::Set(Scalar x, Scalar v)
+{
+    xpos = x;
+    velocity = v;
+    if (clock)
+        start_time = *clock; // Measured right now
+}
+
+// Moves frog
+void Frog::Move(Scalar x, Scalar y)
+{
+    xpos += x;
+    ypos += y;
+}
+
+// Draws Menu Screen
+void Menu::Draw(int touched, float x, float y, Scoreboard *scoreboard_ptr)
+{
+    SCREEN.SetFontColor(WHITE);
+    if (state == 0)
+    {
+        if (((60 <= x) && SCREEN_WIDTH - 60 > x))
+        {
+            SCREEN.SetFontColor(0x555555); // Button hover highlighting
+            if (((80 <= y) && 100 > y))
+            { // button1
+                SCREEN.FillRectangle(60, 77, 200, 21);
+            }
+            else if (((100 <= y) && 120 > y))
+            { // button2
+                SCREEN.FillRectangle(60, 97, 200, 21);
+            }
+            else if (((120 <= y) && 140 > y))
+            { // button3
+                SCREEN.FillRectangle(60, 117, 200, 21);
+            }
+            else if (((140 <= y) && 160 > y))
+            { // button4
+                SCREEN.FillRectangle(60, 137, 200, 21);
+            }
+        }
+
+        SCREEN.SetFontColor(LIMEGREEN);
+        SCREEN.WriteAt("BOGGER!", 61, 60); // Draw title
+
+        SCREEN.SetFontColor(WHITE); // Draw buttons
+        SCREEN.DrawRectangle(60, 77, 200, 21);
+        SCREEN.WriteAt("Play Game", 61, 80);
+        SCREEN.DrawRectangle(60, 97, 200, 21);
+        SCREEN.WriteAt("Stats", 61, 100);
+        SCREEN.DrawRectangle(60, 117, 200, 21);
+        SCREEN.WriteAt("Instructions", 61, 120);
+        SCREEN.DrawRectangle(60, 137, 200, 21);
+        SCREEN.WriteAt("View Credits", 61, 140);
+    }
+
+    else if (state == 1) // Game state
+    {
+        // Display current score
+        scoreboard_ptr->Draw();
+    }
+    else if (state == 2) // Stats state
+    {
+
+        SCREEN.SetFontColor(WHITE);
+        // char cstats[20];
+        SCREEN.WriteAt("STATISTICS:", 61, 60);
+        char tmpstr[20];
+        sprintf(tmpstr, "Highscore: %07d", int(scoreboard_ptr->GetHighScore()));
+        SCREEN.WriteAt(tmpstr, 61, 100);
+        sprintf(tmpstr, "Games played:%5d", int(scoreboard_ptr->GetGamesPlayed()));
+        SCREEN.WriteAt(tmpstr, 61, 120);
+        SCREEN.DrawRectangle(59, 56, 223, 83);
+    }
+    else if (state == 3)
+    { // Instructions state
+
+        SCREEN.WriteAt("INSTRUCTIONS:", 3, 40);
+        SCREEN.WriteAt(" ", 7, 60);
+        SCREEN.WriteAt("The frog will move in the", 7, 80);
+        SCREEN.WriteAt("direction of your mouse.", 7, 100);
+        SCREEN.WriteAt(" ", 7, 120);
+        SCREEN.WriteAt("The objective is to move", 7, 140);
+        SCREEN.WriteAt("the frog from one side of", 7, 160);
+        SCREEN.WriteAt("the map to the other", 7, 180);
+        SCREEN.WriteAt("without hitting anything", 7, 200);
+        SCREEN.WriteAt("or falling in the water.", 7, 220);
+    }
+    else if (state == 4)
+    { // Credits tate
+        SCREEN.DrawRectangle(59, 56, 202, 103);
+        SCREEN.WriteAt("CREDITS: ", 61, 60);
+        SCREEN.WriteAt("AJ Varchetti", 61, 80);
+        SCREEN.WriteAt("Xander Doom", 61, 100);
+        SCREEN.WriteAt("1281.02H: FEH", 61, 120);
+        SCREEN.WriteAt("PAC  8:00", 61, 140);
+    }
+    else if (state == 5)
+    {
+        if (((60 <= x) && SCREEN_WIDTH - 60 > x))
+        {
+            if ((77 <= y) && 98 > y)
+            {
+                SCREEN.SetFontColor(GRAY);
+                SCREEN.FillRectangle(60, 77, 200, 21);
+            }
+
+            else if ((97 <= y) && 118 > y)
+            {
+                SCREEN.SetFontColor(GRAY);
+                SCREEN.FillRectangle(60, 97, 200, 21);
+            }
+
+            else if ((117 <= y) && 138 > y)
+            {
+                SCREEN.SetFontColor(GRAY);
+                SCREEN.FillRectangle(60, 117, 200, 21);
+            }
+
+            else if ((137 <= y) && 158 > y)
+            {
+                SCREEN.SetFontColor(GRAY);
+                SCREEN.FillRectangle(60, 137, 200, 21);
+            }
+        }
+
+        // Draw the Difficulty Screen
+        SCREEN.SetFontColor(WHITE);
+        SCREEN.WriteAt("Difficulty:", 61, 60);
+        SCREEN.DrawRectangle(60, 77, 200, 21);
+        SCREEN.WriteAt("Easy", 61, 80);
+        SCREEN.DrawRectangle(60, 97, 200, 21);
+        SCREEN.WriteAt("Medium", 61, 100);
+        SCREEN.DrawRectangle(60, 117, 200, 21);
+        SCREEN.WriteAt("Hard", 61, 120);
+        SCREEN.DrawRectangle(60, 137, 200, 21);
+        SCREEN.WriteAt("Harder :)", 61, 140);
+    }
+    if (state != 0)
+    { // For all states besides the menu, draw the return button
+        if (((3 <= x) && 83 > x))
+        {
+            if ((3 <= y) && 24 > y)
+            {
+                SCREEN.SetFontColor(GRAY);
+                SCREEN.FillRectangle(3, 3, 80, 22);
+                SCREEN.SetFontColor(WHITE);
+            }
+        }
+        SCREEN.DrawRectangle(3, 3, 80, 22);
+        SCREEN.WriteAt("Return", 4, 7);
+    }
+}
+
+// Updates Menu
+int Menu::Update(int touched, int NewTouched, float x, float y)
+{
+
+    if (touched)
+    {
+        if (state == 0) // Main menu state
+        {
+            if (((60 <= x) && SCREEN_WIDTH - 60 > x))
+            {
+                if (((80 <= y) && 100 > y))
+                { // button1
+                    if (NewTouched)
+                        state = 5;
+                }
+                else if (((100 <= y) && 120 > y))
+                { // button2
+                    if (NewTouched)
+                        state = 2;
+                }
+                else if (((120 <= y) && 140 > y))
+                { // button3
+                    if (NewTouched)
+                        state = 3;
+                }
+                else if (((140 <= y) && 160 > y))
+                { // button4
+                    if (NewTouched)
+                        state = 4;
+                }
+            }
+        }
+        else if (state == 1) // Return button for gameplay state
+        {
+            if (state != 0)
+            { // For all states besides the menu, update the return button
+                if (((3 <= x) && 83 > x))
+                {
+                    if ((3 <= y) && 24 > y)
+                    {
+                        state = 0;
+                        return 1;
+                    }
+                }
+            }
+        }
+
+        else if (state == 5) // Get difficulty state
+        {
+            if (((60 <= x) && SCREEN_WIDTH - 60 > x))
+            {
+                if ((77 <= y) && 98 > y)
+                {
+                    config = PRESETS[0]; // Set the difficulty to easy
+                    state = 1;           // set to game running state
+                }
+
+                else if ((97 <= y) && 118 > y)
+                {
+                    config = PRESETS[1]; // Set the difficulty to medium
+                    state = 1;           // set to game running state
+                }
+
+                else if ((117 <= y) && 138 > y)
+                {
+                    config = PRESETS[2]; // Set the difficulty to hard
+                    state = 1;           // set to game running state
+                }
+
+                else if ((137 <= y) && 158 > y)
+                {
+                    config = PRESETS[3]; // Set the difficulty to harder :)
+                    state = 1;           // set to game running state
+                }
+            }
+        }
+
+        if (state != 0)
+        { // For all states besides the menu, update the return button
+            if (((3 <= x) && 83 > x))
+            {
+                if ((3 <= y) && 24 > y)
+                {
+                    state = 0;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+// Takes the click location and entity pointer, then determines the direction the frog moves based on the location of the click relative to the frog
+// Returns 1 for up, 2 for right, 3 for down, 4 for left
+int getUserInput(float x, float y, Entity *e)
+{
+
+    // line1 is -3/4x + line1b. True is above the line, false is below.
+    // line 2 is 3/4x + line2b
+    bool line1, line2;
+
+    // Y-intercept of the lines through the frog
+    float line1b = float(e->getYpos()) - (-.75 * float(e->getXpos())) + 8;
+    float line2b = float(e->getYpos()) - (.75 * float(e->getXpos())) + 8;
+
+    // If above line1
+    if (y >= -3.0 / 4 * (x - 8) + line1b)
+    {
+        line1 = true;
+    }
+    else
+    {
+        line1 = false;
+    }
+
+    // If above line2
+    if (y >= 3.0 / 4 * (x - 8) + line2b)
+    {
+        line2 = true;
+    }
+    else
+    {
+        line2 = false;
+    }
+
+    // Determines what zone the touch was in.
+    if (line1 && line2)
+    {
+        return 3; // Zone 3
+    }
+    else if (!line1 && line2)
+    {
+        return 4; // Zone 4
+    }
+    else if (line1 && !line2)
+    {
+        return 2; // Zone 2
+    }
+    else
+    {
+        return 1; // Zone 1
+    }
+}
+
+// Ends game and resets the game to be playable again.
+void endGame(Game *game_ptr)
+{
+
+    // Set the program state back to the main menu
+    // state = 0;
+
+    // Save and reset the scoreboard
+    game_ptr->scoreboard.Save(SCORES_PATH); // Save the current score
+    game_ptr->scoreboard.Reset();           // Reset the scoreboard
+    game_ptr->scoreboard.Load(SCORES_PATH); // Reload the number of games and highscores
+
+    game_ptr->Reset();
+}
+
+// Add a death to the game's telemetry, if it has any
+void recordDeath(Game *game_ptr, unsigned char cause, Scalar frame_time)
+{
+    if (!game_ptr->telemetry)
+        return;
+
+    World *world_ptr = &game_ptr->world;
+    int row = game_ptr->frog_row;
+    unsigned char row_kind = KIND_GRASS;
+    if (world_ptr->GetRowType(row) == typeid(Road).name())
+        row_kind = KIND_ROAD;
+    else if (world_ptr->GetRowType(row) == typeid(Water).name())
+        row_kind = KIND_WATER;
+
+    game_ptr->telemetry->Record(cause, row, row_kind, world_ptr->GetRowVariant(row), float(world_ptr->GetTime()),
+                                float(world_ptr->GetConfig().difficulty), float(frame_time));
+}
+
+// Append the waiting events as one block
+void Telemetry::Write(void)
+{
+    if (count == 0)
+        return;
+
+    FILE *out = fopen(path, "ab"); // Append, earlier runs stay in the file
+    if (out)
+    {
+        unsigned int magic = TELEMETRY_MAGIC;
+        fwrite(&magic, sizeof(magic), 1, out);
+        fwrite(&count, sizeof(count), 1, out);
+        fwrite(times, sizeof(times[0]), count, out);
+        fwrite(difficulties, sizeof(difficulties[0]), count, out);
+        fwrite(frame_times, sizeof(frame_times[0]), count, out);
+        fwrite(rows, sizeof(rows[0]), count, out);
+        fwrite(causes, sizeof(causes[0]), count, out);
+        fwrite(row_kinds, sizeof(row_kinds[0]), count, out);
+        fwrite(row_variants, sizeof(row_variants[0]), count, out);
+        fclose(out);
+    }
+    count = 0;
+}
+
+// Save the score right away, then hold the game where the frog died
+void GameOver::Start(Game *game_ptr)
+{
+    game = game_ptr;
+    frog_x = int(game->frog->getXpos());
+    game->scoreboard.Save(SCORES_PATH); // Save the current score
+    if (game->telemetry)
+        game->telemetry->Flush(); // Deaths are rare when playing, so write them while the game is paused anyway
+    phase = 1;
+    timer = 0;
+}
+
+// One frame of the game over sequence
+void GameOver::Tick(Scalar dt, bool touched, bool new_touch)
+{
+    timer += dt;
+    switch (phase)
+    {
+    case 1:
+        if (timer >= DEATH_TIME)
+            phase = 2; // Done flashing, so the menu isn't instantly dismissed
+        break;
+    case 2:
+        if (!touched)
+            phase = 3; // Let go
+        break;
+    case 3:
+        if (new_touch)
+            Finish(); // Clicked to play again
+        break;
+    }
+}
+
+void GameOver::Draw(void)
+{
+    if (!phase)
+        return;
+
+    SCREEN.SetFontColor(RED);
+    if (phase == 1 && int(timer * 8) % 2 == 0)
+    { // Flash a box around the frog (it's always drawn two rows up)
+        SCREEN.DrawRectangle(frog_x, SCREEN_HEIGHT - 3 * TILE_HEIGHT, TILE_WIDTH, TILE_HEIGHT);
+    }
+    SCREEN.WriteAt("GAME OVER", 12, 26);
+    // sprintf(cscore, "Score: %07d", int(score));
+    // SCREEN.WriteAt(cscore, 61, 80);
+}
+
+// The score is already saved, so just reset everything for a new game
+void GameOver::Finish(void)
+{
+    game->scoreboard.Reset();           // Reset the scoreboard
+    game->scoreboard.Load(SCORES_PATH); // Reload the number of games and highscores
+    game->Reset();
+    phase = 0;
+}
+
+// Wait out the rest of the frame
+void FramePacer::Wait(void)
+{
+    MEMORY.NewFrame();
+    double left = next_frame - TimeNow();
+    if (left < 0)
+    { // Over budget. Start the next frame now instead of rushing to catch up
+        overruns++;
+        next_frame = TimeNow() + budget;
+        return;
+    }
+
+    if (left > SPIN_TIME)
+        Sleep(int((left - SPIN_TIME) * 1000)); // Sleep through most of it
+    while (TimeNow() < next_frame)
+        ; // Spin the last bit
+    next_frame += budget;
+}
+
+bool LiveMetrics::Open(void)
+{
+#if LIVE_METRICS
+    static_assert(std::atomic<uint32_t>::is_always_lock_free, "the sequence has to work across processes");
+    snprintf(name, sizeof(name), "%s.%d", METRICS_NAME, int(getpid()));
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+    if (fd < 0 || ftruncate(fd, sizeof(MetricsBlock)) != 0)
+    {
+        if (fd >= 0)
+            close(fd);
+        printf("Couldn't create live metrics %s\n", name);
+        return false;
+    }
+    void *memory = mmap(NULL, sizeof(MetricsBlock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd); // The mapping stays
+    if (memory == MAP_FAILED)
+    {
+        shm_unlink(name);
+        printf("Couldn't map live metrics %s\n", name);
+        return false;
+    }
+    block = new (memory) MetricsBlock();
+    block->pid = getpid();
+    block->version = METRICS_VERSION;
+    block->magic.store(METRICS_MAGIC, std::memory_order_release); // Readers ignore the block until this is set
+    start_time = last_time = TimeNow();
+    return true;
+#else
+    return false;
+#endif
+}
+
+LiveMetrics::~LiveMetrics(void)
+{
+#if LIVE_METRICS
+    if (block)
+    {
+        munmap(block, sizeof(MetricsBlock));
+        shm_unlink(name);
+    }
+#endif
+}
+
+// Work out this frame's numbers, then copy them into the block between two sequence bumps
+void LiveMetrics::Publish(int state, int row, Scoreboard *scoreboard, World *world)
+{
+    if (!LIVE_METRICS || failed)
+        return;
+    if (!block)
+    {
+        failed = !Open();
+        return; // The first frame only starts the clock
+    }
+
+    double now = TimeNow();
+    frame_ms[frames % METRICS_WINDOW] = (now - last_time) * 1000;
+    last_time = now;
+    frames++;
+
+    int count = std::min<uint64_t>(frames, METRICS_WINDOW);
+    float sorted[METRICS_WINDOW], total = 0;
+    std::copy(frame_ms, frame_ms + count, sorted);
+    std::sort(sorted, sorted + count);
+    for (int i = 0; i < count; i++)
+        total += sorted[i];
+
+    MetricsSample sample;
+    sample.frames = frames;
+    sample.uptime = now - start_time;
+    sample.fps = total > 0 ? 1000 * count / total : 0;
+    sample.frame_ms_p50 = sorted[count * 50 / 100];
+    sample.frame_ms_p95 = sorted[count * 95 / 100];
+    sample.frame_ms_p99 = sorted[count * 99 / 100];
+    sample.frame_ms_max = sorted[count - 1];
+    sample.state = state;
+    sample.row = row;
+    sample.score = int(scoreboard->GetScore());
+    sample.high_score = int(scoreboard->GetHighScore());
+    sample.games_played = int(scoreboard->GetGamesPlayed());
+    sample.difficulty = float(world->GetConfig().difficulty);
+    for (int tag = 0; tag < MEM_TAGS; tag++)
+    {
+        sample.memory_live[tag] = MEMORY.Live(tag);
+        sample.memory_peak[tag] = MEMORY.Peak(tag);
+    }
+    sample.frame_allocations = int(MEMORY.LastFrameAllocations());
+
+    uint32_t sequence = block->sequence.load(std::memory_order_relaxed);
+    block->sequence.store(sequence + 1, std::memory_order_relaxed); // Odd, readers back off
+    std::atomic_thread_fence(std::memory_order_release);
+    block->sample = sample; // Plain copy, readers throw away whatever they read while it's going on
+    block->sequence.store(sequence + 2, std::memory_order_release); // Even again, the sample is whole
+}
+
+// Give a new touch an ID and remember when it was read
+int LatencyTracer::Touch(void)
+{
+    if (!LATENCY_TRACE)
+        return -1;
+#ifdef BOGGER_THREADS
+    std::lock_guard<std::mutex> lock(mutex);
+#endif
+    pending.push_back({next_id, 0, TimeNow(), {0}});
+    return next_id++;
+}
+
+void LatencyTracer::Mark(int id, int stage)
+{
+    if (!LATENCY_TRACE || id < 0)
+        return;
+#ifdef BOGGER_THREADS
+    std::lock_guard<std::mutex> lock(mutex);
+#endif
+    for (Trace &t : pending)
+    {
+        if (t.id == id && !t.times[stage])
+            t.times[stage] = TimeNow();
+    }
+}
+
+void LatencyTracer::Shown(int id, int frame)
+{
+    if (!LATENCY_TRACE || id < 0)
+        return;
+#ifdef BOGGER_THREADS
+    std::lock_guard<std::mutex> lock(mutex);
+#endif
+    for (Trace &t : pending)
+    {
+        if (t.id == id && !t.frame)
+            t.frame = frame;
+    }
+}
+
+void LatencyTracer::Drawn(int frame)
+{
+    if (!LATENCY_TRACE)
+        return;
+#ifdef BOGGER_THREADS
+    std::lock_guard<std::mutex> lock(mutex);
+#endif
+    double now = TimeNow();
+    for (Trace &t : pending)
+    {
+        if (t.frame && t.frame <= frame && !t.times[TRACE_DRAWN])
+            t.times[TRACE_DRAWN] = now;
+    }
+}
+
+void LatencyTracer::Present(void)
+{
+    if (!LATENCY_TRACE)
+        return;
+#ifdef BOGGER_THREADS
+    std::lock_guard<std::mutex> lock(mutex);
+#endif
+    double now = TimeNow();
+    int kept = 0;
+    for (Trace &t : pending)
+    {
+        if (!t.times[TRACE_DRAWN])
+        {
+            pending[kept++] = t; // Still on its way
+            continue;
+        }
+        if (!t.times[TRACE_INPUT])
+            continue; // Menu touch or a tap that didn't move the frog
+        t.times[TRACE_PRESENTED] = now;
+        for (int stage = 0; stage < TRACE_STAGES; stage++)
+        {
+            if (t.times[stage])
+                latencies[stage].push_back((t.times[stage] - t.touch_time) * 1000);
+        }
+    }
+    pending.resize(kept);
+    ReportIfDone();
+}
+
+void LatencyTracer::Report(void)
+{
+    if (!LATENCY_TRACE)
+        return;
+#ifdef BOGGER_THREADS
+    std::lock_guard<std::mutex> lock(mutex);
+#endif
+    report_before = next_id;
+    ReportIfDone(); // Right away if nothing is still on its way
+}
+
+// Print the spread of latencies since the last report, if one is waiting and every touch it covers is done
+// The lock is already held
+void LatencyTracer::ReportIfDone(void)
+{
+    static const char *names[TRACE_STAGES] = {"input", "simulated", "drawn", "presented"};
+    if (report_before < 0)
+        return;
+    for (Trace &t : pending)
+    {
+        if (t.id < report_before)
+            return; // Not presented yet
+    }
+    report_before = -1;
+    if (latencies[0].empty())
+        return;
+
+    printf("Input latency over %d moves (ms after the touch was read)\n", int(latencies[0].size()));
+    for (int stage = 0; stage < TRACE_STAGES; stage++)
+    {
+        std::vector<float> &l = latencies[stage];
+        if (l.empty())
+            continue;
+        std::sort(l.begin(), l.end());
+        printf("%10s: min %6.2f  p50 %6.2f  p90 %6.2f  p99 %6.2f  max %6.2f\n", names[stage],
+               l.front(), l[l.size() / 2], l[l.size() * 9 / 10], l[l.size() * 99 / 100], l.back());
+        l.clear();
+    }
+}
+
+#if MEMORY_STATS
+// Every allocation goes through here, tagged with whatever MemoryScope is active
+void *operator new(size_t size)
+{
+    return trackedAlloc(size, memory_tag);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    trackedFree(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    trackedFree(ptr);
+}
+
+// The library uses these for temporary buffers, and frees them with the plain delete above
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    try
+    {
+        return trackedAlloc(size, memory_tag);
+    }
+    catch (const std::bad_alloc &)
+    {
+        return NULL;
+    }
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept
+{
+    trackedFree(ptr);
+}
+
+// The size and tag are kept in a header in front of the block, so frees know what to take off
+void *trackedAlloc(size_t size, int tag)
+{
+    char *block = (char *)malloc(size + MEMORY_HEADER);
+    if (!block)
+        throw std::bad_alloc();
+    ((size_t *)block)[0] = size;
+    ((size_t *)block)[1] = tag;
+    MEMORY.Allocated(tag, size);
+    return block + MEMORY_HEADER;
+}
+
+void trackedFree(void *ptr)
+{
+    if (!ptr)
+        return;
+    char *block = (char *)ptr - MEMORY_HEADER;
+    MEMORY.Freed(((size_t *)block)[1], ((size_t *)block)[0]);
+    free(block);
+}
+#endif
+
+// Compare and swap until the peak is at least now, so a higher peak from another thread is never overwritten
+void MemoryStats::RaisePeak(std::atomic<long> &peak, long now)
+{
+    long old = peak.load(std::memory_order_relaxed);
+    while (now > old && !peak.compare_exchange_weak(old, now, std::memory_order_relaxed))
+    {
+    }
+}
+
+void MemoryStats::Allocated(int tag, long bytes)
+{
+    if (!MEMORY_STATS)
+        return;
+    RaisePeak(peak[tag], live[tag] += bytes);
+    RaisePeak(peak_total, live_total += bytes);
+    allocations[tag]++;
+    frame_allocations++;
+}
+
+void MemoryStats::Freed(int tag, long bytes)
+{
+    if (!MEMORY_STATS)
+        return;
+    live[tag] -= bytes;
+    live_total -= bytes;
+}
+
+void MemoryStats::NewFrame(void)
+{
+    if (!MEMORY_STATS)
+        return;
+    long count = frame_allocations.exchange(0);
+    last_frame_allocations = count;
+    RaisePeak(max_frame_allocations, count);
+    frame_allocations_total += count;
+    frames++;
+}
+
+void MemoryStats::Report(void)
+{
+    static const char *names[MEM_TAGS] = {"other", "world", "rows", "entities", "scores", "assets"};
+    if (!MEMORY_STATS)
+        return;
+
+    printf("Memory          live B     peak B  allocations\n");
+    for (int tag = 0; tag < MEM_TAGS; tag++)
+    {
+        printf("%10s %10ld %10ld %12ld\n", names[tag], long(live[tag]), long(peak[tag]), long(allocations[tag]));
+    }
+    printf("%10s %10ld %10ld\n", "total", long(live_total), long(peak_total));
+    printf("Allocations per frame over %ld frames: %.1f average, %ld most\n", long(frames),
+           frames ? double(frame_allocations_total) / frames : 0, long(max_frame_allocations));
+}
+
+Renderer::Renderer(LatencyTracer *new_tracer)
+{
+    tracer = new_tracer;
+#ifdef PIPELINE
+    thread = std::thread(&Renderer::Work, this);
+#endif
 }
 
-// Return Width of an Entity
-float Entity::getWidth()
+Renderer::~Renderer()
 {
-    return width;
+#ifdef PIPELINE
+    frames.Close();
+    thread.join();
+#endif
 }
 
-// Return Velocity of an Entity
-float Entity::getVelocity()
+// Read the touchscreen. Pipelined, it was read on the render thread after the last frame it presented
+bool Renderer::Touch(float *x, float *y)
 {
-    return velocity;
+#ifdef PIPELINE
+    std::lock_guard<std::mutex> lock(touch_mutex);
+    *x = touch_x;
+    *y = touch_y;
+    return touch_down;
+#else
+    return LCD.Touch(x, y);
+#endif
 }
 
-// Moves frog
-void Frog::Move(float x, float y)
+void Renderer::Publish(Menu *menu, Game *game, GameOver *game_over, bool touched, float touchx, float touchy, int trace)
 {
-    xpos += x;
-    ypos += y;
+    tracer->Shown(trace, ++published);
+#ifdef PIPELINE
+    FrameState *frame = frames.Back();
+    frame->menu = *menu;
+    frame->game_over = *game_over;
+    frame->scoreboard = game->scoreboard;
+    if (menu->GetState() == 1)
+        game->Save(&frame->game); // Whatever is on screen always fits
+    frame->touched = touched;
+    frame->touchx = touchx;
+    frame->touchy = touchy;
+    frame->number = published;
+    frames.Publish(); // If the last frame hasn't been taken it's skipped, and its touches are drawn with this one
+#else
+    Draw(menu, game, NULL, &game->scoreboard, game_over, touched, touchx, touchy, published); // No render thread, so draw it now
+#endif
 }
 
-// Draws Menu Screen
-void Menu::Draw(int touched, float x, float y, Scoreboard *scoreboard_ptr)
+// Draw whichever screen the menu is on and present it
+void Renderer::Draw(Menu *menu, Game *game, const GameSnapshot *saved, Scoreboard *scoreboard, GameOver *game_over, bool touched, float touchx, float touchy, int number)
 {
-    LCD.SetFontColor(WHITE);
-    if (state == 0)
+    QUALITY.Begin(); // Time the drawing
+
+    switch (menu->GetState()) // Switch case for the state of the game
     {
-        if (((60 <= x) && SCREEN_WIDTH - 60 > x))
-        {
-            LCD.SetFontColor(0x555555); // Button hover highlighting
-            if (((80 <= y) && 100 > y))
-            { // button1
-                LCD.FillRectangle(60, 77, 200, 21);
-            }
-            else if (((100 <= y) && 120 > y))
-            { // button2
-                LCD.FillRectangle(60, 97, 200, 21);
-            }
-            else if (((120 <= y) && 140 > y))
-            { // button3
-                LCD.FillRectangle(60, 117, 200, 21);
-            }
-            else if (((140 <= y) && 160 > y))
-            { // button4
-                LCD.FillRectangle(60, 137, 200, 21);
-            }
+
+    case 1:
+        if (QUALITY.Level() < QUALITY_LOW)
+            SCREEN.Clear();
+        else if (QUALITY.RefreshHUD())
+        { // The rows cover everything below the HUD, so only clear the strip above them, and only when the HUD is redrawn
+            SCREEN.SetFontColor(BLACK);
+            SCREEN.FillRectangle(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT - ROWS_ON_SCREEN * TILE_HEIGHT);
         }
+        // Draw all rows on screen, starting with the frog row
+        if (game)
+            game->Draw();
+        else
+            DrawSnapshot(saved);
+        game_over->Draw();
+        break;
+
+    case 0:
+        // Menu is displayed elsewhere
+        SCREEN.Clear();
+        break;
+
+    case 2:
+        SCREEN.Clear();
+        // todo Display statistics
+        break;
+
+    case 3:
+        SCREEN.Clear();
+        // todo Display instructions
+        break;
+
+    case 4:
+        SCREEN.Clear();
+        // todo Display credits
+        break;
+    case 5:
+        SCREEN.Clear();
+        // todo Get difficulty
+    }
 
-        LCD.SetFontColor(LIMEGREEN);
-        LCD.WriteAt("BOGGER!", 61, 60); // Draw title
+    if (menu->GetState() != 1)
+        QUALITY.HUDCleared(); // Menus clear the whole screen, so a game starting next frame has to draw its HUD right away
 
-        LCD.SetFontColor(WHITE); // Draw buttons
-        LCD.DrawRectangle(60, 77, 200, 21);
-        LCD.WriteAt("Play Game", 61, 80);
-        LCD.DrawRectangle(60, 97, 200, 21);
-        LCD.WriteAt("Stats", 61, 100);
-        LCD.DrawRectangle(60, 117, 200, 21);
-        LCD.WriteAt("Instructions", 61, 120);
-        LCD.DrawRectangle(60, 137, 200, 21);
-        LCD.WriteAt("View Credits", 61, 140);
-    }
+    // Update menu (scoreboard is passsed for statistics screen display)
+    menu->Draw(touched, touchx, touchy, scoreboard);
+    tracer->Drawn(number);
 
-    else if (state == 1) // Game state
-    {
-        // Display current score
-        scoreboard_ptr->Draw();
-    }
-    else if (state == 2) // Stats state
+    SCREEN.Present(); // Frame finished
+    tracer->Present();
+    QUALITY.End(); // Pick how much to draw next frame
+}
+
+#ifdef PIPELINE
+// Draw the newest frame whenever there is one, then read the touchscreen for the game
+void Renderer::Work(void)
+{
+    FrameState *frame;
+    while ((frame = frames.Take()))
     {
+        Draw(&frame->menu, NULL, &frame->game, &frame->scoreboard, &frame->game_over, frame->touched, frame->touchx, frame->touchy, frame->number);
 
-        LCD.SetFontColor(WHITE);
-        // char cstats[20];
-        LCD.WriteAt("STATISTICS:", 61, 60);
-        char tmpstr[20];
-        sprintf(tmpstr, "Highscore: %07d", int(scoreboard_ptr->GetHighScore()));
-        LCD.WriteAt(tmpstr, 61, 100);
-        sprintf(tmpstr, "Games played:%5d", int(scoreboard_ptr->GetGamesPlayed()));
-        LCD.WriteAt(tmpstr, 61, 120);
-        LCD.DrawRectangle(59, 56, 223, 83);
+        float x, y;
+        {
+            std::lock_guard<std::mutex> lock(touch_mutex);
+            x = touch_x; // LCD.Touch leaves these alone when nothing is touched
+            y = touch_y;
+        }
+        bool down = LCD.Touch(&x, &y);
+        std::lock_guard<std::mutex> lock(touch_mutex);
+        touch_down = down;
+        touch_x = x;
+        touch_y = y;
     }
-    else if (state == 3)
-    { // Instructions state
+}
+#endif
 
-        LCD.WriteAt("INSTRUCTIONS:", 3, 40);
-        LCD.WriteAt(" ", 7, 60);
-        LCD.WriteAt("The frog will move in the", 7, 80);
-        LCD.WriteAt("direction of your mouse.", 7, 100);
-        LCD.WriteAt(" ", 7, 120);
-        LCD.WriteAt("The objective is to move", 7, 140);
-        LCD.WriteAt("the frog from one side of", 7, 160);
-        LCD.WriteAt("the map to the other", 7, 180);
-        LCD.WriteAt("without hitting anything", 7, 200);
-        LCD.WriteAt("or falling in the water.", 7, 220);
-    }
-    else if (state == 4)
-    { // Credits tate
-        LCD.DrawRectangle(59, 56, 202, 103);
-        LCD.WriteAt("CREDITS: ", 61, 60);
-        LCD.WriteAt("AJ Varchetti", 61, 80);
-        LCD.WriteAt("Xander Doom", 61, 100);
-        LCD.WriteAt("1281.02H: FEH", 61, 120);
-        LCD.WriteAt("PAC  8:00", 61, 140);
-    }
-    else if (state == 5)
+// Draw the rows on screen from a snapshot, bottom up from two below the frog. Rows below the snapshot are grass
+void Renderer::DrawSnapshot(const GameSnapshot *snap)
+{
+    int start_row = snap->frog_row - 2;
+    for (int row = 0; row < ROWS_ON_SCREEN; row++)
     {
-        if (((60 <= x) && SCREEN_WIDTH - 60 > x))
+        int i = start_row + row - snap->first_row; // Index into the snapshot
+        if (i >= snap->num_rows)
+            break; // Not generated yet
+        const RowState *row_state = i < 0 ? NULL : &snap->rows[i];
+        int kind = row_state ? row_state->kind : KIND_GRASS;
+
+        if (kind == KIND_ROAD)
+            Road::DrawBackground(row);
+        else if (kind == KIND_WATER)
+            Water::DrawBackground(row, snap->time);
+        else
+            Grass::DrawBackground(row);
+
+        // Obstacles, then the frog last like it is in its row. Grass rows draw theirs twice at full quality, like Grass::Draw
+        for (int pass = 0; pass < (kind == KIND_GRASS && QUALITY.Level() == QUALITY_FULL ? 2 : 1); pass++)
         {
-            if ((77 <= y) && 98 > y)
+            for (int j = 0; row_state && j < row_state->num_entities; j++)
             {
-                LCD.SetFontColor(GRAY);
-                LCD.FillRectangle(60, 77, 200, 21);
+                const EntityState *e = &row_state->entities[j];
+                if (e->kind == KIND_LOG)
+                    Log::DrawAt(row, e->xpos, e->width, LOG_HEIGHT);
+                else if (e->kind == KIND_TURTLE)
+                    Turtle::DrawAt(row, e->xpos, snap->time);
+                else
+                    Car::DrawAt(row, e->xpos);
             }
+            if (start_row + row == snap->frog_row)
+                Frog::DrawAt(row, snap->frog_x, snap->time - snap->frog_hop_time);
+        }
+    }
+}
 
-            else if ((97 <= y) && 118 > y)
-            {
-                LCD.SetFontColor(GRAY);
-                LCD.FillRectangle(60, 97, 200, 21);
-            }
+// Start timing a frame
+void Quality::Begin(void)
+{
+    start = TimeNow();
+    frame++;
+}
 
-            else if ((117 <= y) && 138 > y)
-            {
-                LCD.SetFontColor(GRAY);
-                LCD.FillRectangle(60, 117, 200, 21);
-            }
+// Move down a level after QUALITY_FRAMES slow frames in a row, or up a level after QUALITY_UP_FRAMES fast ones
+// Needing a run of frames keeps one slow frame from changing anything, and the gap between the two limits keeps
+// the level from flipping back and forth
+void Quality::End(void)
+{
+    double used = TimeNow() - start;
 
-            else if ((137 <= y) && 158 > y)
-            {
-                LCD.SetFontColor(GRAY);
-                LCD.FillRectangle(60, 137, 200, 21);
-            }
-        }
+    over = used > QUALITY_DOWN * budget ? over + 1 : 0;
+    under = used < QUALITY_UP * budget ? under + 1 : 0;
 
-        // Draw the Difficulty Screen
-        LCD.SetFontColor(WHITE);
-        LCD.WriteAt("Difficulty:", 61, 60);
-        LCD.DrawRectangle(60, 77, 200, 21);
-        LCD.WriteAt("Easy", 61, 80);
-        LCD.DrawRectangle(60, 97, 200, 21);
-        LCD.WriteAt("Medium", 61, 100);
-        LCD.DrawRectangle(60, 117, 200, 21);
-        LCD.WriteAt("Hard", 61, 120);
-        LCD.DrawRectangle(60, 137, 200, 21);
-        LCD.WriteAt("Harder :)", 61, 140);
+    if (over >= QUALITY_FRAMES && level < QUALITY_LOW)
+    {
+        level++;
+        changes++;
+        over = 0;
     }
-    if (state != 0)
-    { // For all states besides the menu, draw the return button
-        if (((3 <= x) && 83 > x))
-        {
-            if ((3 <= y) && 24 > y)
-            {
-                LCD.SetFontColor(GRAY);
-                LCD.FillRectangle(3, 3, 80, 22);
-                LCD.SetFontColor(WHITE);
-            }
-        }
-        LCD.DrawRectangle(3, 3, 80, 22);
-        LCD.WriteAt("Return", 4, 7);
+    else if (under >= QUALITY_UP_FRAMES && level > QUALITY_FULL)
+    {
+        level--;
+        changes++;
+        under = 0;
     }
 }
 
-// Updates Menu
-int Menu::Update(int touched, int NewTouched, float x, float y)
+// Start the game over on fresh grass
+void Game::Reset()
 {
+    if (frog_row < world.NumRows())
+        world.removeFromRow(frog_row, frog); // The frog is kept, so take it out before its row is deleted
+    world.Reset();
+    // Initalize the world with the starting rows
+    world.AddRow(new Grass());
+    world.AddRow(new Grass());
+    world.AddRow(new Grass());
+    world.AddRow(new Grass());
+    world.AddRow(new Grass());
+    SPRITES.Fetch(&SPRITE_GRASS); // Load what the first frame shows before it's drawn, like Generate does
+    SPRITES.Fetch(&SPRITE_FROG);
+
+    frog_row = 2; // Reset the frog's position
+    frog->Reset();
+    world.addToRow(frog_row, frog);
+}
 
-    if (touched)
+// Move the frog, then run collisions and move everything else. Returns 1 if the frog died
+int Game::Step(int move, Scalar dt)
+{
+    Entity *collided_object = NULL;
+
+    if (move)
     {
-        if (state == 0) // Main menu state
+        world.removeFromRow(frog_row, frog);
+        frog->Hop();
+
+        switch (move)
         {
-            if (((60 <= x) && SCREEN_WIDTH - 60 > x))
+
+        case 1:
+            // Move frog up if click is above frog, update score
+            frog_row++;
+            scoreboard.AddRow();
+            break;
+        case 2:
+            // Move frog right if click is right of frog
+            if (frog->getXpos() < SCREEN_WIDTH - TILE_WIDTH)
             {
-                if (((80 <= y) && 100 > y))
-                { // button1
-                    if (NewTouched)
-                        state = 5;
-                }
-                else if (((100 <= y) && 120 > y))
-                { // button2
-                    if (NewTouched)
-                        state = 2;
-                }
-                else if (((120 <= y) && 140 > y))
-                { // button3
-                    if (NewTouched)
-                        state = 3;
-                }
-                else if (((140 <= y) && 160 > y))
-                { // button4
-                    if (NewTouched)
-                        state = 4;
-                }
+                frog->Move(TILE_WIDTH, 0);
             }
-        }
-        else if (state == 1) // Return button for gameplay state
-        {
-            if (state != 0)
-            { // For all states besides the menu, update the return button
-                if (((3 <= x) && 83 > x))
-                {
-                    if ((3 <= y) && 24 > y)
-                    {
-                        state = 0;
-                        return 1;
-                    }
-                }
+            break;
+        case 3:
+            // Move frog down if click is below frog, update score
+            if (frog_row >= 3)
+            {
+                frog_row--;
+                scoreboard.RemRow();
+            }
+            break;
+        case 4:
+            // Move frog left if click is left of frog
+            if (frog->getXpos() > TILE_WIDTH - 1)
+            {
+                frog->Move(-TILE_WIDTH, 0);
             }
+            break;
         }
+        world.addToRow(frog_row, frog);
+    }
 
-        else if (state == 5) // Get difficulty state
-        {
-            if (((60 <= x) && SCREEN_WIDTH - 60 > x))
-            {
-                if ((77 <= y) && 98 > y)
-                {
-                    difficulty = 0.4; // Set the difficulty to easy
-                    state = 1;        // set to game running state
-                }
+    // Set the scoreboard to zero if the player is at the start
+    if (frog_row <= 3)
+        scoreboard.Reset();
 
-                else if ((97 <= y) && 118 > y)
-                {
-                    difficulty = 0.8; // Set the difficulty to medium
-                    state = 1;        // set to game running state
-                }
+    // Generate new rows based on the frog's position
+    world.Generate(frog_row + ROWS_AHEAD);
 
-                else if ((117 <= y) && 138 > y)
-                {
-                    difficulty = 1.3; // Set the difficulty to hard
-                    state = 1;        // set to game running state
-                }
+    collided_object = world.checkCollision(frog_row, frog); // Run collision logic and return a pointer to any object the frog collides with
 
-                else if ((137 <= y) && 158 > y)
-                {
-                    difficulty = 2.0; // Set the difficulty to harder :)
-                    state = 1;        // set to game running state
-                }
+    if (world.GetRowType(frog_row) == typeid(Water).name()) // If the frog is in a water row
+    {
+        if (collided_object == NULL)
+        { // Water collision
+            recordDeath(this, DEATH_WATER, dt);
+            return 1;
+        }
+        else if (typeid(*collided_object).name() == typeid(Log).name()) // Collision with a log
+        {
+            if (!(frog->getXpos() < 1) && !(frog->getXpos() > (SCREEN_WIDTH - frog->getWidth())))
+            {
+                frog->Move(collided_object->getVelocity() * dt, 0); // move the frog at the speed of the log
             }
         }
-
-        if (state != 0)
-        { // For all states besides the menu, update the return button
-            if (((3 <= x) && 83 > x))
+        else if (typeid(*collided_object).name() == typeid(Turtle).name()) // Collision with a turtle
+        {
+            if (!(frog->getXpos() < 1) && !(frog->getXpos() > (SCREEN_WIDTH - frog->getWidth())))
             {
-                if ((3 <= y) && 24 > y)
-                {
-                    state = 0;
-                }
+                frog->Move(collided_object->getVelocity() * dt, 0); // move the frog at the speed of the turtle
             }
         }
     }
+    else if (collided_object != NULL) // Collision with anything else
+    {
+        recordDeath(this, DEATH_CAR, dt);
+        return 1;
+    }
+
+    world.Update(dt);       // Move every row along
+    scoreboard.RemTime(dt); // Update the scoreboard based on the time on screen
     return 0;
 }
 
-// Takes the click location and entity pointer, then determines the direction the frog moves based on the location of the click relative to the frog
-// Returns 1 for up, 2 for right, 3 for down, 4 for left
-int getUserInput(float x, float y, Entity *e)
+// Draw all rows on screen, starting two below the frog
+void Game::Draw()
+{
+    world.Draw(frog_row - 2);
+}
+
+// Copies the current game into a snapshot
+bool Game::Save(GameSnapshot *snap)
 {
+    memset((void *)snap, 0, sizeof(*snap)); // Padding and unused slots too, so the same game always saves to the same bytes
+    snap->frog_row = frog_row;
+    snap->frog_x = frog->getXpos();
+    snap->score = scoreboard.GetExactScore();
+    snap->time = world.GetTime();
+    snap->frog_hop_time = frog->GetHopTime();
+    snap->config = world.GetConfig();
+    return world.Save(snap, frog);
+}
 
-    // line1 is -3/4x + line1b. True is above the line, false is below.
-    // line 2 is 3/4x + line2b
-    bool line1, line2;
+// Puts the game back the way it was when the snapshot was taken
+void Game::Load(const GameSnapshot *snap)
+{
+    world.removeFromRow(frog_row, frog); // Take the frog out so it isn't deleted with its row
+    world.Load(snap);
 
-    // Y-intercept of the lines through the frog
-    float line1b = e->getYpos() - (-.75 * e->getXpos()) + 8;
-    float line2b = e->getYpos() - (.75 * e->getXpos()) + 8;
+    frog_row = snap->frog_row;
+    frog->Set(snap->frog_x, 0);
+    frog->SetHopTime(snap->frog_hop_time);
+    world.addToRow(frog_row, frog);
 
-    // If above line1
-    if (y >= -3.0 / 4 * (x - 8) + line1b)
-    {
-        line1 = true;
-    }
-    else
+    scoreboard.SetExactScore(snap->score);
+    SetConfig(snap->config);
+}
+
+// Start up a number of games for training
+BatchEnv::BatchEnv(int num_envs, GameConfig config, Telemetry *telemetry)
+{
+    for (int i = 0; i < num_envs; i++)
     {
-        line1 = false;
+        games.push_back(new Game());
+        games.back()->SetConfig(config);
+        games.back()->telemetry = telemetry;
     }
+}
 
-    // If above line2
-    if (y >= 3.0 / 4 * (x - 8) + line2b)
+BatchEnv::~BatchEnv()
+{
+    for (Game *g : games)
     {
-        line2 = true;
+        delete g;
     }
-    else
+}
+
+// Start every game over and write their first observations
+void BatchEnv::Reset(unsigned char *observations)
+{
+    parallelFor(games.size(), [&](int first, int last)
+                {
+                    for (int i = first; i < last; i++)
+                    {
+                        games[i]->scoreboard.Reset();
+                        games[i]->Reset();
+                        games[i]->world.Generate(games[i]->frog_row + ROWS_AHEAD);
+                        games[i]->world.Observe(games[i]->frog_row - 2, OBS_ROWS, &observations[i * OBS_SIZE]);
+                    } });
+}
+
+// Step every game once. The reward is the change in score, plus DEATH_REWARD if the frog died
+void BatchEnv::Step(const int *actions, unsigned char *observations, float *rewards, unsigned char *dones)
+{
+    parallelFor(games.size(), [&](int first, int last)
+                {
+                    for (int i = first; i < last; i++)
+                    {
+                        Game *g = games[i];
+                        int64_t old_score = g->scoreboard.GetExactScore();
+                        dones[i] = g->Step(actions[i], ENV_DT);
+                        rewards[i] = float(g->scoreboard.GetExactScore() - old_score) / SCORE_SCALE;
+                        if (dones[i])
+                        { // Start the next episode right away
+                            rewards[i] += DEATH_REWARD;
+                            g->scoreboard.Reset();
+                            g->Reset();
+                            g->world.Generate(g->frog_row + ROWS_AHEAD);
+                        }
+                        g->world.Observe(g->frog_row - 2, OBS_ROWS, &observations[i * OBS_SIZE]);
+                    } });
+}
+
+// Branch a game off of another one through a snapshot. Nothing changes if the snapshot couldn't hold the whole game
+bool BatchEnv::Copy(int from, int to)
+{
+    GameSnapshot snap;
+    if (!games[from]->Save(&snap))
     {
-        line2 = false;
+        printf("Game %d doesn't fit in a snapshot, not copying it\n", from);
+        return false;
     }
+    games[to]->Load(&snap);
+    return true;
+}
 
-    // Determines what zone the touch was in.
-    if (line1 && line2)
+// Start up a number of games, each with its own input feed
+SessionHost::SessionHost(int num_sessions, GameConfig config)
+{
+    for (int i = 0; i < num_sessions; i++)
     {
-        return 3; // Zone 3
+        sessions.push_back(new Game());
+        sessions.back()->SetConfig(config);
+        inputs.push_back(InputQueue());
+        players.push_back(LoopbackInput(i + 1));
+        stats.push_back(SessionStats());
     }
-    else if (!line1 && line2)
+}
+
+SessionHost::~SessionHost()
+{
+    for (Game *g : sessions)
     {
-        return 4; // Zone 4
+        delete g;
     }
-    else if (line1 && !line2)
+}
+
+// Run every session for a number of fixed length ticks
+void SessionHost::Run(int num_ticks)
+{
+    Scalar dt = Scalar(1) / HOST_TICK_RATE; // Every session sees the same fixed tick, no matter how long the host takes
+    double start_time = TimeNow();
+    FramePacer pacer(HOST_TICK_RATE);
+
+    for (int tick = 0; tick < num_ticks; tick++)
     {
-        return 2; // Zone 2
+        for (int i = 0; i < int(sessions.size()); i++)
+        { // Feed the inputs for this tick
+            int move = players[i].NextMove();
+            if (move)
+                inputs[i].Push(move);
+        }
+
+        parallelFor(sessions.size(), [&](int first, int last)
+                    {
+                        for (int i = first; i < last; i++)
+                        {
+                            double step_start = TimeNow();
+                            if (sessions[i]->Step(inputs[i].Pop(), dt))
+                            { // Dead, so record it and start over
+                                stats[i].deaths++;
+                                stats[i].best_score = std::max(stats[i].best_score, int(sessions[i]->scoreboard.GetScore()));
+                                sessions[i]->scoreboard.Reset();
+                                sessions[i]->Reset();
+                            }
+                            double step_time = TimeNow() - step_start;
+                            stats[i].ticks++;
+                            stats[i].total_step_time += step_time;
+                            stats[i].max_step_time = std::max(stats[i].max_step_time, step_time);
+                        } });
+
+#if CAPTURE_MODE > 0
+        // Record the first session
+        SCREEN.Clear();
+        sessions[0]->Draw();
+        SCREEN.Present();
+#endif
+
+        pacer.Wait(); // Sleep off the rest of the tick
     }
-    else
+    overruns += pacer.overruns;
+    run_time += TimeNow() - start_time;
+}
+
+// Print how each session did
+void SessionHost::Report(void)
+{
+    printf("Hosted %d sessions for %.2f s (%d ticks over budget)\n", int(sessions.size()), run_time, overruns);
+    for (int i = 0; i < int(sessions.size()); i++)
     {
-        return 1; // Zone 1
+        SessionStats *st = &stats[i];
+        printf("Session %3d: %6d ticks %8.1f ticks/s  step avg %7.1f us  max %7.1f us  deaths %4d  best %7d\n",
+               i, st->ticks, st->ticks / run_time,
+               st->ticks ? st->total_step_time / st->ticks * 1e6 : 0, st->max_step_time * 1e6,
+               st->deaths, st->best_score);
     }
 }
 
-// Ends game and resets the game to be playable again.
-void endGame(Scoreboard *scoreboard_ptr, World *world_ptr, int *frog_row_ptr, Frog *frog_ptr)
+// Checks that run instead of the game in SELF_TEST builds. Prints what was checked and returns how many checks failed
+// The output doesn't depend on the number type, so float and fixed point builds have to print exactly the same thing
+int selfTest(void)
 {
+    int failures = 0;
+
+    // Snapshots: play randomly, and every so often save the game, load it into another one and save that. Both
+    // snapshots have to hold the whole game and match byte for byte
+    Game game, copy;
+    game.SetConfig(PRESETS[1]);
+    LoopbackInput player(1);
+    GameSnapshot first, second;
+    int round_trips = 0, mismatches = 0;
+    for (int step = 0; step < TEST_STEPS; step++)
+    {
+        if (game.Step(player.NextMove(), Scalar(1) / 64))
+        { // Died, start over
+            game.scoreboard.Reset();
+            game.Reset();
+        }
+        if (step % TEST_SAVE_EVERY == 0)
+        {
+            bool whole = game.Save(&first);
+            copy.Load(&first);
+            whole = copy.Save(&second) && whole;
+            if (!whole || memcmp(&first, &second, sizeof(first)))
+                mismatches++;
+            round_trips++;
+        }
+    }
+    printf("snapshot round trips: %d, mismatched: %d\n", round_trips, mismatches);
+    failures += mismatches;
+
+    // Scoring: on a world of nothing but grass, climb on Harder well past where a Q16.16 score would overflow, waiting
+    // a while on every row, and keep the score in step with the rules worked out separately
+    GameSnapshot start;
+    memset((void *)&start, 0, sizeof(start)); // Every row is grass
+    start.frog_row = 2;
+    start.num_rows = SNAPSHOT_ROWS;
+    start.frog_x = SCREEN_WIDTH / 2;
+    start.frog_hop_time = -FROG_HOP_TIME;
+    start.config = PRESETS[3];
+    game.Load(&start);
+    const Scalar dt = Scalar(1) / 64; // Exact in both number types
+    int64_t expected = 0, penalty = TIME_PENALTY * SCORE_SCALE / 64;
+    for (int row = 3; row <= 2 + TEST_ROWS; row++)
+    {
+        for (int step = 0; step <= TEST_WAIT_STEPS; step++)
+        {
+            int move = step == TEST_WAIT_STEPS ? 1 : 0; // Wait, then hop up
+            game.Step(move, dt);
+            if (move)
+                expected += int64_t(PRESETS[3].row_points) * SCORE_SCALE;
+            if (row <= 3)
+                expected = 0; // Nothing counts until the frog leaves the starting rows
+            expected = std::max<int64_t>(0, expected - penalty);
+        }
+        bool right = game.frog_row == row && game.scoreboard.GetExactScore() == expected;
+        printf("row %2d: score %9.3f, expected %9.3f%s\n", row, game.scoreboard.GetExactScore() / double(SCORE_SCALE),
+               expected / double(SCORE_SCALE), right ? "" : " WRONG");
+        failures += !right;
+    }
 
-    int x;
-    int y;
-
-    // Set the program state back to the main menu
-    // state = 0;
-
-    // Save and reset the scoreboard
-    scoreboard_ptr->Save(SCORES_PATH); // Save the current score
-    scoreboard_ptr->Reset();           // Reset the scoreboard
-    scoreboard_ptr->Load(SCORES_PATH); // Reload the number of games and highscores
-
-    LCD.SetFontColor(RED);
-    LCD.WriteAt("GAME OVER", 12, 26);
-    // sprintf(cscore, "Score: %07d", int(score));
-    // LCD.WriteAt(cscore, 61, 80);
-
-    world_ptr->Reset();
-    // Initalize the world with the three starting rows
-    world_ptr->AddRow(new Grass());
-    world_ptr->AddRow(new Grass());
-    world_ptr->AddRow(new Grass());
-    world_ptr->AddRow(new Grass());
-    world_ptr->AddRow(new Grass());
-
-    *frog_row_ptr = 2; // Reset the frog's position
-    frog_ptr->Reset();
-    world_ptr->addToRow(2, frog_ptr);
-
-    Sleep(0.2); // Pause the program so the menu isn't instantly dismissed
-
-    while (LCD.Touch(&x, &y))
-        ; // Let go
-    while (!LCD.Touch(&x, &y))
-        ; // freeze until user clicks
-}
\ No newline at end of file
+    printf(failures ? "FAILED\n" : "passed\n");
+    return failures;
+}
@@ -0,0 +1,162 @@
+//********************************************************
+//* Polls the live metrics a running game publishes      *
+//* (built with -DLIVE_METRICS=1) and prints a line for  *
+//* every update. Any number of these can run at once.   *
+//* Build: g++ -O2 -o metrics_reader metrics_reader.cpp  *
+//* Usage: ./metrics_reader <game pid> [poll ms]         *
+//********************************************************
+
+#include "cstdio"
+#include "cstdlib"
+#include "cstdint"
+#include "atomic"
+#include "sys/mman.h"
+#include "fcntl.h"
+#include "unistd.h"
+#include "signal.h"
+#include "errno.h"
+#include "sys/stat.h"
+
+// Must match the game
+#define METRICS_NAME "/bogger_metrics"
+#define METRICS_MAGIC 0x4D544742
+#define METRICS_VERSION 2
+#define MEM_TAGS 6
+
+#define WAIT_MS 5000 // How long to wait for the game to publish its block
+#define RETRY_MS 50
+
+struct MetricsSample
+{
+    uint64_t frames;
+    double uptime;
+    float fps;
+    float frame_ms_p50;
+    float frame_ms_p95;
+    float frame_ms_p99;
+    float frame_ms_max;
+    int32_t state;
+    int32_t row;
+    int32_t score;
+    int32_t high_score;
+    int32_t games_played;
+    float difficulty;
+    int64_t memory_live[MEM_TAGS]; // Zero unless the game was built with MEMORY_STATS
+    int64_t memory_peak[MEM_TAGS];
+    int32_t frame_allocations;
+};
+
+struct MetricsBlock
+{
+    std::atomic<uint32_t> magic; // Stored last by the game
+    uint32_t version;
+    std::atomic<uint32_t> sequence;
+    uint32_t pid;
+    MetricsSample sample;
+};
+
+// Copy the sample out, retrying while the game is partway through writing it. Never blocks the game
+MetricsSample readSample(const MetricsBlock *block)
+{
+    MetricsSample sample;
+    while (1)
+    {
+        uint32_t before = block->sequence.load(std::memory_order_acquire);
+        if (before & 1)
+            continue; // Being written
+        // Not atomic, so this can race with the game writing it. That's fine for a seqlock: a copy made during a
+        // write is caught by the sequence check below and thrown away, and the fields are plain numbers
+        sample = block->sample;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (block->sequence.load(std::memory_order_relaxed) == before)
+            return sample;
+    }
+}
+
+// Map the game's block once it's been created at full size. NULL if it isn't there yet
+const MetricsBlock *mapBlock(const char *name)
+{
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return NULL;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < off_t(sizeof(MetricsBlock)))
+    { // Not sized yet. Reading a mapping past the end of the object is a SIGBUS
+        close(fd);
+        return NULL;
+    }
+    void *memory = mmap(NULL, sizeof(MetricsBlock), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    return memory == MAP_FAILED ? NULL : (const MetricsBlock *)memory;
+}
+
+// Whether the game is still running. Only ESRCH means it's gone, EPERM is a game run by another user
+bool gameRunning(int pid)
+{
+    return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        printf("Usage: %s <game pid> [poll ms]\n", argv[0]);
+        return 1;
+    }
+    int pid = atoi(argv[1]);
+    int poll_ms = argc > 2 ? atoi(argv[2]) : 500;
+
+    char name[32];
+    snprintf(name, sizeof(name), "%s.%d", METRICS_NAME, pid);
+    // The game creates the block on its first frame, so it may not be ready yet
+    const MetricsBlock *block = mapBlock(name);
+    for (int waited = 0; !block || block->magic.load(std::memory_order_acquire) != METRICS_MAGIC; waited += RETRY_MS)
+    {
+        if (!gameRunning(pid) || waited >= WAIT_MS)
+        {
+            printf("No live metrics at %s. Is the game running with LIVE_METRICS?\n", name);
+            return 1;
+        }
+        usleep(RETRY_MS * 1000);
+        if (!block)
+            block = mapBlock(name);
+    }
+    if (block->version != METRICS_VERSION)
+    {
+        printf("%s isn't a version %d metrics block\n", name, METRICS_VERSION);
+        return 1;
+    }
+
+    printf("  uptime  frames    fps   p50 ms  p95 ms  p99 ms  max ms  state  row    score  highscore  games  difficulty\n");
+    uint64_t last_frames = 0;
+    while (gameRunning(pid))
+    {
+        MetricsSample s = readSample(block);
+        if (s.frames != last_frames)
+        {
+            printf("%8.1f %7llu %6.1f %8.2f %7.2f %7.2f %7.2f %6d %4d %8d %10d %6d %11.2f\n",
+                   s.uptime, (unsigned long long)s.frames, s.fps, s.frame_ms_p50, s.frame_ms_p95, s.frame_ms_p99,
+                   s.frame_ms_max, s.state, s.row, s.score, s.high_score, s.games_played, s.difficulty);
+            int64_t peak_total = 0;
+            for (int tag = 0; tag < MEM_TAGS; tag++)
+                peak_total += s.memory_peak[tag];
+            if (peak_total > 0)
+            { // Built with MEMORY_STATS
+                static const char *names[MEM_TAGS] = {"other", "world", "rows", "entities", "scores", "assets"};
+                printf("   memory KB live/peak:");
+                for (int tag = 0; tag < MEM_TAGS; tag++)
+                {
+                    printf(" %s %.1f/%.1f", names[tag], s.memory_live[tag] / 1024.0, s.memory_peak[tag] / 1024.0);
+                }
+                printf(", %d allocations last frame\n", s.frame_allocations);
+            }
+            fflush(stdout);
+            last_frames = s.frames;
+        }
+        usleep(poll_ms * 1000);
+    }
+    printf("Game %d has exited\n", pid);
+    munmap((void *)block, sizeof(MetricsBlock));
+    shm_unlink(name); // Clean up after a game that didn't get to (already gone if it did)
+    return 0;
+}
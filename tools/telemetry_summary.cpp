@@ -0,0 +1,127 @@
+//********************************************************
+//* Reads the death telemetry written by the game and    *
+//* prints where and how the frog dies.                  *
+//* Build: g++ -O2 -o telemetry_summary telemetry_summary.cpp
+//* Usage: ./telemetry_summary [Telemetry.dat]           *
+//********************************************************
+
+#include "cstdio"
+#include "vector"
+
+// Must match the game
+#define TELEMETRY_MAGIC 0x4C544742
+#define DEATH_WATER 0
+#define DEATH_CAR 1
+#define KIND_GRASS 0
+#define KIND_ROAD 1
+#define KIND_WATER 2
+#define WATER_VARIANTS 4 // Water layouts are 1-4, every other row is 0
+
+int main(int argc, char **argv)
+{
+    const char *path = argc > 1 ? argv[1] : "Telemetry.dat";
+    FILE *in = fopen(path, "rb");
+    if (!in)
+    {
+        printf("Couldn't open %s\n", path);
+        return 1;
+    }
+
+    // Totals
+    long deaths = 0, bad = 0, by_cause[2] = {0, 0}, by_kind[3] = {0, 0, 0}, by_water_variant[WATER_VARIANTS + 1] = {0, 0, 0, 0, 0};
+    double difficulty_sum = 0, frame_time_sum = 0, worst_frame_time = 0;
+    int highest_row = 0;
+
+    // Column buffers, reused for every block
+    std::vector<float> times, difficulties, frame_times;
+    std::vector<int> rows;
+    std::vector<unsigned char> causes, row_kinds, row_variants;
+    std::vector<bool> valid;
+
+    unsigned int header[2]; // magic, count
+    while (fread(header, sizeof(header[0]), 2, in) == 2)
+    {
+        if (header[0] != TELEMETRY_MAGIC)
+        {
+            printf("Bad block after %ld deaths, stopping\n", deaths);
+            break;
+        }
+        unsigned int count = header[1];
+        times.resize(count);
+        difficulties.resize(count);
+        frame_times.resize(count);
+        rows.resize(count);
+        causes.resize(count);
+        row_kinds.resize(count);
+        row_variants.resize(count);
+        valid.resize(count);
+
+        // Columns come one after another, so each is a single read
+        if (fread(times.data(), sizeof(float), count, in) != count ||
+            fread(difficulties.data(), sizeof(float), count, in) != count ||
+            fread(frame_times.data(), sizeof(float), count, in) != count ||
+            fread(rows.data(), sizeof(int), count, in) != count ||
+            fread(causes.data(), 1, count, in) != count ||
+            fread(row_kinds.data(), 1, count, in) != count ||
+            fread(row_variants.data(), 1, count, in) != count)
+        {
+            printf("Cut off block after %ld deaths, stopping\n", deaths);
+            break;
+        }
+
+        // Deaths with a cause, row kind or layout the game never writes are from a damaged file. They're counted
+        // separately and left out of everything else, instead of landing in some other bucket
+        unsigned int good = 0;
+        for (unsigned int i = 0; i < count; i++)
+        {
+            valid[i] = causes[i] <= DEATH_CAR && row_kinds[i] <= KIND_WATER &&
+                       (row_kinds[i] == KIND_WATER ? row_variants[i] >= 1 && row_variants[i] <= WATER_VARIANTS
+                                                   : row_variants[i] == 0);
+            good += valid[i];
+        }
+
+        // Each total only scans the columns it needs
+        for (unsigned int i = 0; i < count; i++)
+        {
+            if (!valid[i])
+                continue;
+            by_cause[causes[i]]++;
+            by_kind[row_kinds[i]]++;
+            if (row_kinds[i] == KIND_WATER)
+                by_water_variant[row_variants[i]]++;
+        }
+        for (unsigned int i = 0; i < count; i++)
+        {
+            if (!valid[i])
+                continue;
+            difficulty_sum += difficulties[i];
+            frame_time_sum += frame_times[i];
+            if (frame_times[i] > worst_frame_time)
+                worst_frame_time = frame_times[i];
+            if (rows[i] > highest_row)
+                highest_row = rows[i];
+        }
+        deaths += good;
+        bad += count - good;
+    }
+    fclose(in);
+
+    if (bad > 0)
+        printf("Skipped %ld deaths with out of range values\n", bad);
+    if (deaths == 0)
+    {
+        printf("No deaths recorded\n");
+        return 0;
+    }
+
+    printf("Deaths: %ld\n", deaths);
+    printf("  Drowned:      %ld (%.1f%%)\n", by_cause[DEATH_WATER], 100.0 * by_cause[DEATH_WATER] / deaths);
+    printf("  Hit by a car: %ld (%.1f%%)\n", by_cause[DEATH_CAR], 100.0 * by_cause[DEATH_CAR] / deaths);
+    printf("By row: grass %ld, road %ld, water %ld\n", by_kind[KIND_GRASS], by_kind[KIND_ROAD], by_kind[KIND_WATER]);
+    printf("By water layout: 1: %ld, 2: %ld, 3: %ld, 4 (turtles): %ld\n",
+           by_water_variant[1], by_water_variant[2], by_water_variant[3], by_water_variant[4]);
+    printf("Average difficulty: %.2f\n", difficulty_sum / deaths);
+    printf("Frame time at death: average %.1f ms, worst %.1f ms\n", 1000 * frame_time_sum / deaths, 1000 * worst_frame_time);
+    printf("Furthest row reached: %d\n", highest_row);
+    return 0;
+}